@@ -3,5 +3,11 @@ CC ?= gcc
 CXX ?= g++
 
 _FLAGS    = -Wall -Wextra -O3 -fPIC -Wno-unused-parameter
+
+# record per-instance run() cost, see common/runstats.h
+ifeq ($(RUN_STATS),true)
+_FLAGS   += -DMOD_RUN_STATS
+endif
+
 CFLAGS   += $(_FLAGS) -std=c99
 CXXFLAGS += $(_FLAGS) -std=c++11
@@ -0,0 +1,43 @@
+/*
+ * MIDI clock and time code definitions, shared by the plugins reading and generating them.
+ */
+
+#ifndef MIDICLOCK_H_INCLUDED
+#define MIDICLOCK_H_INCLUDED
+
+#include <stdint.h>
+
+// MIDI clock pulses per quarter note
+#define MIDI_CLOCK_PPQN 24
+
+// MIDI clock pulses per song position pointer step, a 16th note
+#define MIDI_CLOCK_SPP_PULSES 6
+
+// system messages used for clock and time code
+enum {
+    kMidiSysEx = 0xF0, // MTC full frame is F0 7F <device> 01 01 hh mm ss ff F7
+    kMidiTimeCodeQuarterFrame = 0xF1,
+    kMidiSongPositionPointer = 0xF2,
+    kMidiClock = 0xF8,
+    kMidiClockStart = 0xFA,
+    kMidiClockContinue = 0xFB,
+    kMidiClockStop = 0xFC
+};
+
+// size of an MTC full frame message
+#define MIDI_MTC_FULL_FRAME_SIZE 10
+
+// values of the play status ports, as defined in the TTLs
+static const float kPlayStatusUndefined = 0.0f;
+static const float kPlayStatusStart = 1.0f;
+static const float kPlayStatusStop = 2.0f;
+static const float kPlayStatusContinue = 3.0f;
+
+// frames per second for each MTC rate (24, 25, 29.97 drop-frame and 30), as exact fractions
+static const uint32_t kMTCFrameRateNum[4] = { 24, 25, 30000, 30 };
+static const uint32_t kMTCFrameRateDen[4] = { 1, 1, 1001, 1 };
+
+// the MTC rate using drop-frame numbering
+#define MIDI_MTC_RATE_DROP_FRAME 2
+
+#endif // MIDICLOCK_H_INCLUDED
@@ -0,0 +1,884 @@
+/*
+ * Multichannel digital peak and RMS meter, the same meter as Kmeterdsp (see peak-to-cc.lv2/peakmeter),
+ * for up to 8 channels metered together.
+ *
+ * All meter state is kept in structure of arrays layout, one array per field with one entry per channel,
+ * so a single SIMD register holds the same field of several channels: 4 lanes per vector with SSE2 or NEON,
+ * 8 with AVX2, on input transposed a few frames at a time from the channel buffers. The NEON kernel runs the plain
+ * one-pole recursions of the meter frame by frame, one lane per channel. The x86 kernels advance 4 frames per step
+ * and, with fewer channels than lanes, fill the other lanes with later frames of the same channels, see the time
+ * segments section below.
+ * Lanes past the channel count read the first channel, their results are not used.
+ * As for Kmeterdsp, the kernel is chosen when the meter is initialized, from what the build and CPU support.
+ * The levels match separate Kmeterdsp meters within 2e-6 with the peak detector, and 1e-4 with the RMS one.
+ *
+ * Samples are split into fixed hops, independent of the host block size. At the end of each hop the level
+ * of every channel is updated, with the peak hold and fallback of Kmeterdsp, or the ballistic filter level
+ * for the RMS detector. The peak detector does not run the ballistic filters at all.
+ */
+
+#ifndef MULTIMETER_H_INCLUDED
+#define MULTIMETER_H_INCLUDED
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define MULTI_METER_X86
+# include <immintrin.h>
+#endif
+
+#ifdef __ARM_NEON
+# include <arm_neon.h>
+#endif
+
+#define MULTI_METER_MAX_CHANNELS 8
+
+typedef enum {
+    MULTI_METER_PEAK = 0, // digital peak, with hold and fallback
+    MULTI_METER_RMS,      // two stage ballistic filter on the squared signal, VU like
+    MULTI_METER_DETECTOR_COUNT
+} MultiMeterDetector;
+
+typedef enum {
+    MULTI_METER_KERNEL_AUTO = 0, // fastest one supported by this build and CPU
+    MULTI_METER_KERNEL_SCALAR,
+    MULTI_METER_KERNEL_SSE2,
+    MULTI_METER_KERNEL_AVX2,
+    MULTI_METER_KERNEL_NEON,
+    MULTI_METER_KERNEL_COUNT
+} MultiMeterKernelType;
+
+// filter state of all channels, z1 and z2 are only used by the RMS detector
+// plugin data is not allocated with any particular alignment, so the kernels use unaligned loads
+typedef struct {
+    float z0[MULTI_METER_MAX_CHANNELS];
+    float z1[MULTI_METER_MAX_CHANNELS];
+    float z2[MULTI_METER_MAX_CHANNELS];
+    float pk[MULTI_METER_MAX_CHANNELS]; // squared digital peak of the current hop so far
+    float wdcf, adcf;                   // dc filter coefficient, and 1 minus it
+    float wrms, arms;                   // ballistic filter coefficient, and 1 minus it
+    uint32_t channels;
+} MultiMeterFilters;
+
+// runs the filters over `frames` samples of each channel, starting at `offset`
+typedef void (*MultiMeterKernel)(MultiMeterFilters* f, const float* const* in, uint32_t offset, uint32_t frames);
+
+typedef struct {
+    MultiMeterFilters f;
+    MultiMeterKernel kernels[MULTI_METER_DETECTOR_COUNT];
+    int detector;
+
+    // analysis hop, and ballistics per hop
+    uint32_t sample_rate;
+    uint32_t hop;
+    uint32_t fill; // samples already in the current hop
+    float hold_time, fall_rate;
+    uint32_t hold;
+    float fall;
+
+    // per channel levels, as of the end of the last complete hop
+    float level[MULTI_METER_MAX_CHANNELS]; // of the current detector
+    float dpk[MULTI_METER_MAX_CHANNELS];
+    float rms[MULTI_METER_MAX_CHANNELS];
+    uint32_t cnt[MULTI_METER_MAX_CHANNELS]; // peak hold counter
+} MultiMeter;
+
+// --------------------------------------------------------------------------------------------------------------------
+// Scalar kernel, the same recursions as the Kmeterdsp scalar kernel, one channel after the other
+
+static inline __attribute__((always_inline))
+void multi_meter_scalar(MultiMeterFilters* const f, const float* const* const in,
+                        const uint32_t offset, const uint32_t frames, const bool rms)
+{
+    for (uint32_t c = 0; c < f->channels; ++c)
+    {
+        const float* const p = in[c] + offset;
+        float z0 = f->z0[c], z1 = f->z1[c], z2 = f->z2[c], t = f->pk[c];
+
+        for (uint32_t i = 0; i < frames; ++i)
+        {
+            float s = p[i];
+
+            if (s < -1.0f)
+                s = -1.0f;
+            else if (s > 1.0f)
+                s = 1.0f;
+
+            z0 += f->wdcf * (s - z0);
+            s -= z0;
+            s *= s;
+            if (t < s)
+                t = s;
+
+            if (rms)
+            {
+                z1 += f->wrms * (s - z1);
+                z2 += f->wrms * (z1 - z2);
+            }
+        }
+
+        f->z0[c] = z0;
+        f->z1[c] = z1;
+        f->z2[c] = z2;
+        f->pk[c] = t;
+    }
+}
+
+static void multi_meter_scalar_peak(MultiMeterFilters* f, const float* const* in, uint32_t offset, uint32_t frames)
+{
+    multi_meter_scalar(f, in, offset, frames, false);
+}
+
+static void multi_meter_scalar_rms(MultiMeterFilters* f, const float* const* in, uint32_t offset, uint32_t frames)
+{
+    multi_meter_scalar(f, in, offset, frames, true);
+}
+
+// input of each lane, those past the channel count read the first channel
+static inline void multi_meter_lane_inputs(const MultiMeterFilters* const f, const float* const* const in,
+                                           const uint32_t offset, const float* lanes[MULTI_METER_MAX_CHANNELS])
+{
+    for (uint32_t l = 0; l < MULTI_METER_MAX_CHANNELS; ++l)
+        lanes[l] = in[l < f->channels ? l : 0] + offset;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Time segments, for the x86 kernels
+//
+// The x86 kernels advance 4 frames per step. With fewer channels than lanes, each vector holds several segments of
+// 4 consecutive frames, lane l holding channel l % channels and segment l / channels, `channels` being rounded up to
+// a power of 2. The filter recursions y[k] = a y[k-1] + b[k] first run over the frames of all segments at once from
+// a zero state, giving v[k], then y[k] = v[k] + a^(k+1) z[j] for the segment j, from the state entering it:
+// z[j] = a^(4 j) z + sum over i < j of a^(4 (j - 1 - i)) v[3] of segment i, z being the state before the step.
+// The state after the step likewise takes a single multiply-add from z, so the recursions of successive steps overlap.
+
+#define MULTI_METER_MAX_SEGMENTS 4
+
+// a^(4 j) in `p`, and a^(4 (j - 1 - i)) in `q[i]` or 0 for i >= j, for the segment j of each lane
+static inline void multi_meter_segment_powers(const float a, const uint32_t channels, const uint32_t lanes,
+                                              float* const p, float q[][MULTI_METER_MAX_CHANNELS])
+{
+    const float a4 = a * a * a * a;
+
+    for (uint32_t l = 0; l < lanes; ++l)
+    {
+        const uint32_t j = l / channels;
+
+        p[l] = 1.0f;
+
+        for (uint32_t k = 0; k < j; ++k)
+            p[l] *= a4;
+
+        for (uint32_t i = 0; i + 1 < lanes / channels; ++i)
+        {
+            q[i][l] = i < j ? 1.0f : 0.0f;
+
+            for (uint32_t k = i + 1; k < j; ++k)
+                q[i][l] *= a4;
+        }
+    }
+}
+
+// filter state or peak of each channel from `first` on, repeated over the segments
+static inline void multi_meter_segment_spread(const float* const state, const uint32_t first, const uint32_t channels,
+                                              const uint32_t lanes, float* const out)
+{
+    for (uint32_t l = 0; l < lanes; ++l)
+        out[l] = state[first + l % channels];
+}
+
+// filter state of each channel from `first` on, all segments hold the state after the last one,
+// and its squared peak from all segments
+static inline void multi_meter_segment_collect(MultiMeterFilters* const f, const uint32_t first,
+                                               const uint32_t channels, const uint32_t lanes,
+                                               const float* const z0, const float* const z1, const float* const z2,
+                                               const float* const pk, const bool rms)
+{
+    for (uint32_t c = 0; c < channels && first + c < f->channels; ++c)
+    {
+        f->z0[first + c] = z0[c];
+
+        if (rms)
+        {
+            f->z1[first + c] = z1[c];
+            f->z2[first + c] = z2[c];
+        }
+
+        f->pk[first + c] = pk[c];
+
+        for (uint32_t l = c + channels; l < lanes; l += channels)
+            if (f->pk[first + c] < pk[l])
+                f->pk[first + c] = pk[l];
+    }
+}
+
+#ifdef MULTI_METER_X86
+// --------------------------------------------------------------------------------------------------------------------
+// SSE2 kernel, 4 lanes
+// up to 2 channels in 2 segments, otherwise channels 1-4 and 5-8 in two vectors,
+// the input transposed 4 frames at a time
+
+__attribute__((target("sse2"), always_inline))
+static inline __m128 multi_meter_sse2_clip(const __m128 s)
+{
+    return _mm_min_ps(_mm_max_ps(s, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+}
+
+// segment `j` of each channel, over all segments
+__attribute__((target("sse2"), always_inline))
+static inline __m128 multi_meter_sse2_segment(const __m128 v, const uint32_t j, const uint32_t channels)
+{
+    if (channels == 4)
+        return v;
+    return j == 0 ? _mm_movelh_ps(v, v) : _mm_movehl_ps(v, v);
+}
+
+// one pole filter y[k] = a y[k-1] + w x[k], over 4 frames of each segment
+typedef struct {
+    __m128 w;
+    __m128 a, a2, a3, a4; // a^(k+1) for the frame k of a segment
+    __m128 p, q;          // state carried over the segments, see above
+    __m128 an;            // a^(4 segments), to carry the state over a whole step
+} MultiMeterSse2Filter;
+
+__attribute__((target("sse2"), always_inline))
+static inline void multi_meter_sse2_filter_init(MultiMeterSse2Filter* const k, const float w, const float a,
+                                                const uint32_t channels)
+{
+    float p[MULTI_METER_MAX_CHANNELS], q[MULTI_METER_MAX_SEGMENTS - 1][MULTI_METER_MAX_CHANNELS];
+    multi_meter_segment_powers(a, channels, 4, p, q);
+
+    k->w  = _mm_set1_ps(w);
+    k->a  = _mm_set1_ps(a);
+    k->a2 = _mm_set1_ps(a * a);
+    k->a3 = _mm_set1_ps(a * a * a);
+    k->a4 = _mm_set1_ps(a * a * a * a);
+    k->p  = _mm_loadu_ps(p);
+    k->q  = _mm_loadu_ps(q[0]);
+    k->an = _mm_set1_ps(p[3] * a * a * a * a);
+}
+
+// filter the 4 frames of `x` in place, from the state in `z`, which is then advanced past them
+// with `serial`, frame by frame instead, which takes fewer instructions but has the state depend on every frame,
+// only for a single segment and when there is another vector to overlap with
+__attribute__((target("sse2"), always_inline))
+static inline void multi_meter_sse2_filter(const MultiMeterSse2Filter* const k, __m128* const z, __m128 x[4],
+                                           const uint32_t channels, const bool serial)
+{
+    if (serial)
+    {
+        for (uint32_t i = 0; i < 4; ++i)
+            x[i] = *z = _mm_add_ps(_mm_mul_ps(k->a, *z), _mm_mul_ps(k->w, x[i]));
+        return;
+    }
+
+    const __m128 v0 = _mm_mul_ps(k->w, x[0]);
+    const __m128 v1 = _mm_add_ps(_mm_mul_ps(k->a, v0), _mm_mul_ps(k->w, x[1]));
+    const __m128 v2 = _mm_add_ps(_mm_mul_ps(k->a, v1), _mm_mul_ps(k->w, x[2]));
+    const __m128 v3 = _mm_add_ps(_mm_mul_ps(k->a, v2), _mm_mul_ps(k->w, x[3]));
+
+    // the state after the step takes a single multiply and add from the one before it, the rest is off that chain
+    __m128 c = *z, u = v3;
+
+    if (channels != 4)
+    {
+        const __m128 t = _mm_mul_ps(k->q, multi_meter_sse2_segment(v3, 0, channels));
+
+        c = _mm_add_ps(_mm_mul_ps(k->p, c), t);
+        u = _mm_add_ps(v3, _mm_mul_ps(k->a4, t));
+    }
+
+    x[0] = _mm_add_ps(v0, _mm_mul_ps(k->a, c));
+    x[1] = _mm_add_ps(v1, _mm_mul_ps(k->a2, c));
+    x[2] = _mm_add_ps(v2, _mm_mul_ps(k->a3, c));
+    x[3] = _mm_add_ps(v3, _mm_mul_ps(k->a4, c));
+
+    *z = _mm_add_ps(_mm_mul_ps(k->an, *z), multi_meter_sse2_segment(u, 4 / channels - 1, channels));
+}
+
+// squared distance of the input `s` from the dc filter output `y`, the input of the peak and the ballistic filters
+__attribute__((target("sse2"), always_inline))
+static inline __m128 multi_meter_sse2_detect(const __m128 s, const __m128 y)
+{
+    const __m128 d = _mm_sub_ps(s, y);
+    return _mm_mul_ps(d, d);
+}
+
+__attribute__((target("sse2"), always_inline))
+static inline void multi_meter_sse2_segments(MultiMeterFilters* const f, const float* const* const in,
+                                             const uint32_t offset, const uint32_t frames, const uint32_t channels,
+                                             const uint32_t groups, const bool rms)
+{
+    const uint32_t step = 16 / channels;
+
+    MultiMeterSse2Filter dcf, bal;
+    multi_meter_sse2_filter_init(&dcf, f->wdcf, f->adcf, channels);
+    multi_meter_sse2_filter_init(&bal, f->wrms, f->arms, channels);
+
+    const float* p[MULTI_METER_MAX_CHANNELS];
+    multi_meter_lane_inputs(f, in, offset, p);
+
+    __m128 z0[2], z1[2], z2[2], pk[2];
+    float lanes[4][4];
+
+    for (uint32_t g = 0; g < groups; ++g)
+    {
+        multi_meter_segment_spread(f->z0, 4 * g, channels, 4, lanes[0]);
+        multi_meter_segment_spread(f->z1, 4 * g, channels, 4, lanes[1]);
+        multi_meter_segment_spread(f->z2, 4 * g, channels, 4, lanes[2]);
+        multi_meter_segment_spread(f->pk, 4 * g, channels, 4, lanes[3]);
+
+        z0[g] = _mm_loadu_ps(lanes[0]);
+        z1[g] = _mm_loadu_ps(lanes[1]);
+        z2[g] = _mm_loadu_ps(lanes[2]);
+        pk[g] = _mm_loadu_ps(lanes[3]);
+    }
+
+    const uint32_t end = frames - frames % step;
+
+    for (uint32_t i = 0; i < end; i += step)
+    {
+        for (uint32_t g = 0; g < groups; ++g)
+        {
+            // 4 frames of each lane, transposed to all lanes of each frame
+            __m128 s[4], x[4];
+
+            for (uint32_t r = 0; r < 4; ++r)
+                s[r] = _mm_loadu_ps(p[4 * g + r % channels] + i + 4 * (r / channels));
+
+            _MM_TRANSPOSE4_PS(s[0], s[1], s[2], s[3]);
+
+            for (uint32_t k = 0; k < 4; ++k)
+                x[k] = s[k] = multi_meter_sse2_clip(s[k]);
+
+            multi_meter_sse2_filter(&dcf, &z0[g], x, channels, groups != 1);
+
+            for (uint32_t k = 0; k < 4; ++k)
+                x[k] = multi_meter_sse2_detect(s[k], x[k]);
+
+            pk[g] = _mm_max_ps(pk[g], _mm_max_ps(_mm_max_ps(x[0], x[1]), _mm_max_ps(x[2], x[3])));
+
+            if (rms)
+            {
+                multi_meter_sse2_filter(&bal, &z1[g], x, channels, groups != 1);
+                multi_meter_sse2_filter(&bal, &z2[g], x, channels, groups != 1);
+            }
+        }
+    }
+
+    for (uint32_t g = 0; g < groups; ++g)
+    {
+        _mm_storeu_ps(lanes[0], z0[g]);
+        _mm_storeu_ps(lanes[1], z1[g]);
+        _mm_storeu_ps(lanes[2], z2[g]);
+        _mm_storeu_ps(lanes[3], pk[g]);
+
+        multi_meter_segment_collect(f, 4 * g, channels, 4, lanes[0], lanes[1], lanes[2], lanes[3], rms);
+    }
+
+    if (end != frames)
+        multi_meter_scalar(f, in, offset + end, frames - end, rms);
+}
+
+__attribute__((target("sse2"), always_inline))
+static inline void multi_meter_sse2(MultiMeterFilters* const f, const float* const* const in,
+                                    const uint32_t offset, const uint32_t frames, const bool rms)
+{
+    if (f->channels <= 2)
+        multi_meter_sse2_segments(f, in, offset, frames, 2, 1, rms);
+    else if (f->channels <= 4)
+        multi_meter_sse2_segments(f, in, offset, frames, 4, 1, rms);
+    else
+        multi_meter_sse2_segments(f, in, offset, frames, 4, 2, rms);
+}
+
+__attribute__((target("sse2")))
+static void multi_meter_sse2_peak(MultiMeterFilters* f, const float* const* in, uint32_t offset, uint32_t frames)
+{
+    multi_meter_sse2(f, in, offset, frames, false);
+}
+
+__attribute__((target("sse2")))
+static void multi_meter_sse2_rms(MultiMeterFilters* f, const float* const* in, uint32_t offset, uint32_t frames)
+{
+    multi_meter_sse2(f, in, offset, frames, true);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// AVX2 kernel, 8 lanes
+// up to 2 channels in 4 segments, up to 4 in 2 segments, otherwise all channels in one vector,
+// the input transposed 4 frames at a time within each 128-bit half
+
+__attribute__((target("avx2,fma"), always_inline))
+static inline __m256 multi_meter_avx2_clip(const __m256 s)
+{
+    return _mm256_min_ps(_mm256_max_ps(s, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+}
+
+// segment `j` of each channel, over all segments
+__attribute__((target("avx2,fma"), always_inline))
+static inline __m256 multi_meter_avx2_segment(const __m256 v, const uint32_t j, const uint32_t channels)
+{
+    if (channels == 8)
+        return v;
+    if (channels == 4)
+        return _mm256_permute2f128_ps(v, v, j == 0 ? 0x00 : 0x11);
+
+    const int l = (int)(2 * j);
+    return _mm256_permutevar8x32_ps(v, _mm256_setr_epi32(l, l + 1, l, l + 1, l, l + 1, l, l + 1));
+}
+
+// one pole filter y[k] = a y[k-1] + w x[k], over 4 frames of each segment
+typedef struct {
+    __m256 w;
+    __m256 a, a2, a3, a4;                      // a^(k+1) for the frame k of a segment
+    __m256 p, q[MULTI_METER_MAX_SEGMENTS - 1]; // state carried over the segments, see above
+    __m256 an;                                 // a^(4 segments), to carry the state over a whole step
+} MultiMeterAvx2Filter;
+
+__attribute__((target("avx2,fma"), always_inline))
+static inline void multi_meter_avx2_filter_init(MultiMeterAvx2Filter* const k, const float w, const float a,
+                                                const uint32_t channels)
+{
+    float p[MULTI_METER_MAX_CHANNELS], q[MULTI_METER_MAX_SEGMENTS - 1][MULTI_METER_MAX_CHANNELS];
+    multi_meter_segment_powers(a, channels, 8, p, q);
+
+    k->w  = _mm256_set1_ps(w);
+    k->a  = _mm256_set1_ps(a);
+    k->a2 = _mm256_set1_ps(a * a);
+    k->a3 = _mm256_set1_ps(a * a * a);
+    k->a4 = _mm256_set1_ps(a * a * a * a);
+    k->p  = _mm256_loadu_ps(p);
+    k->an = _mm256_set1_ps(p[7] * a * a * a * a);
+
+    for (uint32_t i = 0; i + 1 < 8 / channels; ++i)
+        k->q[i] = _mm256_loadu_ps(q[i]);
+}
+
+// filter the 4 frames of `x` in place, from the state in `z`, which is then advanced past them
+__attribute__((target("avx2,fma"), always_inline))
+static inline void multi_meter_avx2_filter(const MultiMeterAvx2Filter* const k, __m256* const z, __m256 x[4],
+                                           const uint32_t channels)
+{
+    const uint32_t segments = 8 / channels;
+
+    const __m256 v0 = _mm256_mul_ps(k->w, x[0]);
+    const __m256 v1 = _mm256_fmadd_ps(k->a, v0, _mm256_mul_ps(k->w, x[1]));
+    const __m256 v2 = _mm256_fmadd_ps(k->a, v1, _mm256_mul_ps(k->w, x[2]));
+    const __m256 v3 = _mm256_fmadd_ps(k->a, v2, _mm256_mul_ps(k->w, x[3]));
+
+    // the state after the step takes a single multiply and add from the one before it, the rest is off that chain
+    __m256 c = *z, u = v3;
+
+    if (segments != 1)
+    {
+        __m256 t = _mm256_mul_ps(k->q[0], multi_meter_avx2_segment(v3, 0, channels));
+
+        for (uint32_t i = 1; i + 1 < segments; ++i)
+            t = _mm256_fmadd_ps(k->q[i], multi_meter_avx2_segment(v3, i, channels), t);
+
+        c = _mm256_fmadd_ps(k->p, c, t);
+        u = _mm256_fmadd_ps(k->a4, t, v3);
+    }
+
+    x[0] = _mm256_fmadd_ps(k->a, c, v0);
+    x[1] = _mm256_fmadd_ps(k->a2, c, v1);
+    x[2] = _mm256_fmadd_ps(k->a3, c, v2);
+    x[3] = _mm256_fmadd_ps(k->a4, c, v3);
+
+    *z = _mm256_fmadd_ps(k->an, *z, multi_meter_avx2_segment(u, segments - 1, channels));
+}
+
+__attribute__((target("avx2,fma"), always_inline))
+static inline __m256 multi_meter_avx2_detect(const __m256 s, const __m256 y)
+{
+    const __m256 d = _mm256_sub_ps(s, y);
+    return _mm256_mul_ps(d, d);
+}
+
+// 4 frames of lane `r` of the low half and lane `r` of the high half
+__attribute__((target("avx2,fma"), always_inline))
+static inline __m256 multi_meter_avx2_load(const float* const* const p, const uint32_t i, const uint32_t r,
+                                           const uint32_t channels)
+{
+    if (channels == 4)
+        return _mm256_loadu_ps(p[r] + i);
+
+    const float* const lo = p[r % channels] + i + 4 * (r / channels);
+    const float* const hi = p[(r + 4) % channels] + i + 4 * ((r + 4) / channels);
+
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(lo)), _mm_loadu_ps(hi), 1);
+}
+
+__attribute__((target("avx2,fma"), always_inline))
+static inline void multi_meter_avx2_segments(MultiMeterFilters* const f, const float* const* const in,
+                                             const uint32_t offset, const uint32_t frames, const uint32_t channels,
+                                             const bool rms)
+{
+    const uint32_t step = 32 / channels;
+
+    MultiMeterAvx2Filter dcf, bal;
+    multi_meter_avx2_filter_init(&dcf, f->wdcf, f->adcf, channels);
+    multi_meter_avx2_filter_init(&bal, f->wrms, f->arms, channels);
+
+    const float* p[MULTI_METER_MAX_CHANNELS];
+    multi_meter_lane_inputs(f, in, offset, p);
+
+    float lanes[4][8];
+
+    multi_meter_segment_spread(f->z0, 0, channels, 8, lanes[0]);
+    multi_meter_segment_spread(f->z1, 0, channels, 8, lanes[1]);
+    multi_meter_segment_spread(f->z2, 0, channels, 8, lanes[2]);
+    multi_meter_segment_spread(f->pk, 0, channels, 8, lanes[3]);
+
+    __m256 z0 = _mm256_loadu_ps(lanes[0]);
+    __m256 z1 = _mm256_loadu_ps(lanes[1]);
+    __m256 z2 = _mm256_loadu_ps(lanes[2]);
+    __m256 pk = _mm256_loadu_ps(lanes[3]);
+
+    const uint32_t end = frames - frames % step;
+
+    for (uint32_t i = 0; i < end; i += step)
+    {
+        __m256 s[4], x[4];
+
+        for (uint32_t r = 0; r < 4; ++r)
+            s[r] = multi_meter_avx2_load(p, i, r, channels);
+
+        // 4 frames of each lane, transposed to all lanes of each frame
+        const __m256 t0 = _mm256_unpacklo_ps(s[0], s[1]);
+        const __m256 t1 = _mm256_unpacklo_ps(s[2], s[3]);
+        const __m256 t2 = _mm256_unpackhi_ps(s[0], s[1]);
+        const __m256 t3 = _mm256_unpackhi_ps(s[2], s[3]);
+
+        s[0] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+        s[1] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+        s[2] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        s[3] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+
+        for (uint32_t k = 0; k < 4; ++k)
+            x[k] = s[k] = multi_meter_avx2_clip(s[k]);
+
+        multi_meter_avx2_filter(&dcf, &z0, x, channels);
+
+        for (uint32_t k = 0; k < 4; ++k)
+            x[k] = multi_meter_avx2_detect(s[k], x[k]);
+
+        pk = _mm256_max_ps(pk, _mm256_max_ps(_mm256_max_ps(x[0], x[1]), _mm256_max_ps(x[2], x[3])));
+
+        if (rms)
+        {
+            multi_meter_avx2_filter(&bal, &z1, x, channels);
+            multi_meter_avx2_filter(&bal, &z2, x, channels);
+        }
+    }
+
+    _mm256_storeu_ps(lanes[0], z0);
+    _mm256_storeu_ps(lanes[1], z1);
+    _mm256_storeu_ps(lanes[2], z2);
+    _mm256_storeu_ps(lanes[3], pk);
+
+    multi_meter_segment_collect(f, 0, channels, 8, lanes[0], lanes[1], lanes[2], lanes[3], rms);
+
+    if (end != frames)
+        multi_meter_scalar(f, in, offset + end, frames - end, rms);
+}
+
+__attribute__((target("avx2,fma"), always_inline))
+static inline void multi_meter_avx2(MultiMeterFilters* const f, const float* const* const in,
+                                    const uint32_t offset, const uint32_t frames, const bool rms)
+{
+    if (f->channels <= 2)
+        multi_meter_avx2_segments(f, in, offset, frames, 2, rms);
+    else if (f->channels <= 4)
+        multi_meter_avx2_segments(f, in, offset, frames, 4, rms);
+    else
+        multi_meter_avx2_segments(f, in, offset, frames, 8, rms);
+}
+
+__attribute__((target("avx2,fma")))
+static void multi_meter_avx2_peak(MultiMeterFilters* f, const float* const* in, uint32_t offset, uint32_t frames)
+{
+    multi_meter_avx2(f, in, offset, frames, false);
+}
+
+__attribute__((target("avx2,fma")))
+static void multi_meter_avx2_rms(MultiMeterFilters* f, const float* const* in, uint32_t offset, uint32_t frames)
+{
+    multi_meter_avx2(f, in, offset, frames, true);
+}
+#endif // MULTI_METER_X86
+
+#ifdef __ARM_NEON
+// --------------------------------------------------------------------------------------------------------------------
+// NEON kernel, channels 1-4 and 5-8 in two vectors, with their recursions interleaved
+
+static inline __attribute__((always_inline))
+void multi_meter_neon(MultiMeterFilters* const f, const float* const* const in,
+                      const uint32_t offset, const uint32_t frames, const uint32_t groups, const bool rms)
+{
+    const float32x4_t lo = vdupq_n_f32(-1.0f);
+    const float32x4_t hi = vdupq_n_f32(1.0f);
+    const float32x4_t wd = vdupq_n_f32(f->wdcf);
+    const float32x4_t ad = vdupq_n_f32(f->adcf);
+    const float32x4_t wr = vdupq_n_f32(f->wrms);
+    const float32x4_t ar = vdupq_n_f32(f->arms);
+
+    const float* p[MULTI_METER_MAX_CHANNELS];
+    multi_meter_lane_inputs(f, in, offset, p);
+
+    float32x4_t z0[2], z1[2], z2[2], pk[2];
+
+    for (uint32_t g = 0; g < groups; ++g)
+    {
+        z0[g] = vld1q_f32(f->z0 + 4 * g);
+        z1[g] = vld1q_f32(f->z1 + 4 * g);
+        z2[g] = vld1q_f32(f->z2 + 4 * g);
+        pk[g] = vld1q_f32(f->pk + 4 * g);
+    }
+
+    for (uint32_t i = 0; i < frames; ++i)
+    {
+        for (uint32_t g = 0; g < groups; ++g)
+        {
+            float32x4_t s = vdupq_n_f32(p[4 * g][i]);
+
+            s = vsetq_lane_f32(p[4 * g + 1][i], s, 1);
+            s = vsetq_lane_f32(p[4 * g + 2][i], s, 2);
+            s = vsetq_lane_f32(p[4 * g + 3][i], s, 3);
+
+            s = vminq_f32(vmaxq_f32(s, lo), hi);
+            z0[g] = vmlaq_f32(vmulq_f32(wd, s), ad, z0[g]);
+            s = vsubq_f32(s, z0[g]);
+            s = vmulq_f32(s, s);
+            pk[g] = vmaxq_f32(pk[g], s);
+
+            if (rms)
+            {
+                z1[g] = vmlaq_f32(vmulq_f32(wr, s), ar, z1[g]);
+                z2[g] = vmlaq_f32(vmulq_f32(wr, z1[g]), ar, z2[g]);
+            }
+        }
+    }
+
+    for (uint32_t g = 0; g < groups; ++g)
+    {
+        vst1q_f32(f->z0 + 4 * g, z0[g]);
+        vst1q_f32(f->z1 + 4 * g, z1[g]);
+        vst1q_f32(f->z2 + 4 * g, z2[g]);
+        vst1q_f32(f->pk + 4 * g, pk[g]);
+    }
+}
+
+static void multi_meter_neon_peak(MultiMeterFilters* f, const float* const* in, uint32_t offset, uint32_t frames)
+{
+    if (f->channels > 4)
+        multi_meter_neon(f, in, offset, frames, 2, false);
+    else
+        multi_meter_neon(f, in, offset, frames, 1, false);
+}
+
+static void multi_meter_neon_rms(MultiMeterFilters* f, const float* const* in, uint32_t offset, uint32_t frames)
+{
+    if (f->channels > 4)
+        multi_meter_neon(f, in, offset, frames, 2, true);
+    else
+        multi_meter_neon(f, in, offset, frames, 1, true);
+}
+#endif // __ARM_NEON
+
+// --------------------------------------------------------------------------------------------------------------------
+// Setup, not real-time safe unless noted
+
+// use `kernel` for the sample loops, returns false if it is not supported by this build or CPU
+static inline bool multi_meter_select_kernel(MultiMeter* const meter, const MultiMeterKernelType kernel)
+{
+    switch (kernel)
+    {
+    case MULTI_METER_KERNEL_AUTO:
+        return multi_meter_select_kernel(meter, MULTI_METER_KERNEL_AVX2)
+            || multi_meter_select_kernel(meter, MULTI_METER_KERNEL_NEON)
+            || multi_meter_select_kernel(meter, MULTI_METER_KERNEL_SSE2)
+            || multi_meter_select_kernel(meter, MULTI_METER_KERNEL_SCALAR);
+
+    case MULTI_METER_KERNEL_SCALAR:
+        meter->kernels[MULTI_METER_PEAK] = multi_meter_scalar_peak;
+        meter->kernels[MULTI_METER_RMS]  = multi_meter_scalar_rms;
+        return true;
+
+#ifdef MULTI_METER_X86
+    case MULTI_METER_KERNEL_SSE2:
+        __builtin_cpu_init();
+        if (! __builtin_cpu_supports("sse2"))
+            return false;
+        meter->kernels[MULTI_METER_PEAK] = multi_meter_sse2_peak;
+        meter->kernels[MULTI_METER_RMS]  = multi_meter_sse2_rms;
+        return true;
+
+    case MULTI_METER_KERNEL_AVX2:
+        __builtin_cpu_init();
+        if (! __builtin_cpu_supports("avx2") || ! __builtin_cpu_supports("fma"))
+            return false;
+        meter->kernels[MULTI_METER_PEAK] = multi_meter_avx2_peak;
+        meter->kernels[MULTI_METER_RMS]  = multi_meter_avx2_rms;
+        return true;
+#endif
+
+#ifdef __ARM_NEON
+    case MULTI_METER_KERNEL_NEON:
+        meter->kernels[MULTI_METER_PEAK] = multi_meter_neon_peak;
+        meter->kernels[MULTI_METER_RMS]  = multi_meter_neon_rms;
+        return true;
+#endif
+
+    default:
+        return false;
+    }
+}
+
+static inline const char* multi_meter_kernel_name(const MultiMeterKernelType kernel)
+{
+    static const char* const names[MULTI_METER_KERNEL_COUNT] = { "auto", "scalar", "sse2", "avx2", "neon" };
+
+    return kernel < MULTI_METER_KERNEL_COUNT ? names[kernel] : "";
+}
+
+// change the analysis hop, keeping the meter state, real-time safe
+// the samples already seen count for the next hop, which starts now
+static inline void multi_meter_set_hop(MultiMeter* const meter, const uint32_t hop)
+{
+    const float t = (float)hop / meter->sample_rate; // hop time in seconds
+
+    meter->hop  = hop;
+    meter->fill = 0;
+    meter->hold = (uint32_t)(meter->hold_time / t + 0.5f);
+    meter->fall = powf(10.0f, -0.05f * meter->fall_rate * t);
+}
+
+// reset the meter for `channels` channels, with peak hold time `hold` in seconds and fallback rate `fall` in dB/s
+// the kernel must be selected first
+static inline void multi_meter_init(MultiMeter* const meter, const uint32_t channels,
+                                    const uint32_t sample_rate, const uint32_t hop, const float hold, const float fall)
+{
+    const MultiMeterKernel peak = meter->kernels[MULTI_METER_PEAK];
+    const MultiMeterKernel rms  = meter->kernels[MULTI_METER_RMS];
+
+    memset(meter, 0, sizeof(MultiMeter));
+
+    meter->kernels[MULTI_METER_PEAK] = peak;
+    meter->kernels[MULTI_METER_RMS]  = rms;
+    meter->detector = MULTI_METER_PEAK;
+
+    meter->f.channels = channels < MULTI_METER_MAX_CHANNELS ? channels : MULTI_METER_MAX_CHANNELS;
+    meter->f.wdcf = 5 * 6.28f / sample_rate;
+    meter->f.adcf = 1.0f - meter->f.wdcf;
+    meter->f.wrms = 9.72f / sample_rate;
+    meter->f.arms = 1.0f - meter->f.wrms;
+
+    meter->sample_rate = sample_rate;
+    meter->hold_time = hold;
+    meter->fall_rate = fall;
+
+    multi_meter_set_hop(meter, hop);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Processing, real-time safe
+
+// the ballistic filters do not run for the peak detector, so they restart from silence
+static inline void multi_meter_set_detector(MultiMeter* const meter, const int detector)
+{
+    if (detector == meter->detector)
+        return;
+
+    if (detector == MULTI_METER_RMS)
+    {
+        memset(meter->f.z1, 0, sizeof(meter->f.z1));
+        memset(meter->f.z2, 0, sizeof(meter->f.z2));
+        memset(meter->rms, 0, sizeof(meter->rms));
+    }
+
+    meter->detector = detector == MULTI_METER_RMS ? MULTI_METER_RMS : MULTI_METER_PEAK;
+}
+
+// samples left until the end of the current hop, the size of the hop right after one ends
+static inline uint32_t multi_meter_hop_remaining(const MultiMeter* const meter)
+{
+    return meter->hop - meter->fill;
+}
+
+// update the level of each channel at the end of a hop
+static inline void multi_meter_end_hop(MultiMeter* const meter)
+{
+    MultiMeterFilters* const f = &meter->f;
+
+    for (uint32_t c = 0; c < f->channels; ++c)
+    {
+        const float t = sqrtf(f->pk[c]);
+
+        f->pk[c] = 0.0f;
+
+        // digital peak hold and fallback
+        if (t > meter->dpk[c])
+        {
+            meter->dpk[c] = t;
+            meter->cnt[c] = meter->hold;
+        }
+        else if (meter->cnt[c] != 0)
+        {
+            --meter->cnt[c];
+        }
+        else
+        {
+            meter->dpk[c] *= meter->fall;
+        }
+
+        // ballistic filter level, scaled so that a sine wave reads its peak
+        // the added constants avoid denormals
+        if (meter->detector == MULTI_METER_RMS)
+        {
+            f->z1[c] += 1e-20f;
+            f->z2[c] += 1e-20f;
+            meter->rms[c] = sqrtf(2.0f * f->z2[c]);
+            meter->level[c] = meter->rms[c];
+        }
+        else
+        {
+            meter->level[c] = meter->dpk[c];
+        }
+    }
+}
+
+// meter `frames` samples of each channel in `in`, starting at `offset`
+// returns true if at least one hop ended, and so the levels were updated
+static inline bool multi_meter_process(MultiMeter* const meter, const float* const* const in,
+                                       uint32_t offset, uint32_t frames)
+{
+    bool updated = false;
+
+    while (frames != 0)
+    {
+        const uint32_t remaining = meter->hop - meter->fill;
+        const uint32_t k = remaining < frames ? remaining : frames;
+
+        meter->kernels[meter->detector](&meter->f, in, offset, k);
+
+        offset += k;
+        frames -= k;
+        meter->fill += k;
+
+        if (meter->fill < meter->hop)
+            break;
+
+        meter->fill = 0;
+        multi_meter_end_hop(meter);
+        updated = true;
+    }
+
+    return updated;
+}
+
+#endif // MULTIMETER_H_INCLUDED
@@ -0,0 +1,77 @@
+/*
+ * Tracks which notes are sounding and which channels have sustain held on a MIDI stream,
+ * so that a stream can be silenced with the exact note-offs needed instead of a blanket panic.
+ */
+
+#ifndef NOTETRACKER_H_INCLUDED
+#define NOTETRACKER_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    uint32_t notes[16][4]; // bitset of sounding notes, per channel
+    uint16_t sustain;      // bitset of channels with sustain pedal down
+} NoteTracker;
+
+static inline void note_tracker_reset(NoteTracker* const tracker)
+{
+    memset(tracker, 0, sizeof(NoteTracker));
+}
+
+static inline bool note_tracker_is_active(const NoteTracker* const tracker, const uint8_t channel)
+{
+    const uint32_t* const notes = tracker->notes[channel];
+
+    return (notes[0] | notes[1] | notes[2] | notes[3]) != 0 || (tracker->sustain & (1 << channel)) != 0;
+}
+
+// update tracker state with a MIDI message that was just sent
+static inline void note_tracker_process(NoteTracker* const tracker, const uint8_t* const msg, const uint32_t size)
+{
+    if (size == 1 && msg[0] == 0xFF)
+    {
+        note_tracker_reset(tracker);
+        return;
+    }
+    if (size != 3)
+        return;
+
+    const uint8_t channel = msg[0] & 0x0F;
+    const uint8_t note    = msg[1] & 0x7F;
+
+    switch (msg[0] & 0xF0)
+    {
+    case 0x80:
+        tracker->notes[channel][note >> 5] &= ~(1u << (note & 31));
+        break;
+    case 0x90:
+        // velocity 0 is a note-off
+        if (msg[2] != 0)
+            tracker->notes[channel][note >> 5] |= 1u << (note & 31);
+        else
+            tracker->notes[channel][note >> 5] &= ~(1u << (note & 31));
+        break;
+    case 0xB0:
+        switch (msg[1])
+        {
+        case 0x40: // sustain pedal
+            if (msg[2] >= 64)
+                tracker->sustain |= 1 << channel;
+            else
+                tracker->sustain &= ~(1 << channel);
+            break;
+        case 0x78: // all sounds off
+        case 0x7B: // all notes off
+            memset(tracker->notes[channel], 0, sizeof(tracker->notes[channel]));
+            break;
+        case 0x79: // reset all controllers
+            tracker->sustain &= ~(1 << channel);
+            break;
+        }
+        break;
+    }
+}
+
+#endif // NOTETRACKER_H_INCLUDED
@@ -0,0 +1,418 @@
+/*
+ * Shared multichannel peak to CC core.
+ *
+ * This file is meant to be included once by each multichannel peak-to-cc plugin source,
+ * after defining:
+ *
+ *   PEAK_TO_CC_URI       plugin URI
+ *   PEAK_TO_CC_CHANNELS  number of audio inputs, up to 8
+ *
+ * Each audio input is metered like the single channel peak-to-cc, and its level is sent as its own CC number
+ * on its own MIDI channel. All inputs are metered together by one multichannel meter, see multimeter.h,
+ * and all CCs are written to one output, in frame order, with ties ordered by input number.
+ *
+ * Ports are laid out as: audio inputs, MIDI output, "dropped" and "deferred" output controls,
+ * the detector and update interval controls shared by all inputs, then a CC number and MIDI channel per input.
+ *
+ * The meter runs on a fixed hop, set by the update interval control or taken from the host block length,
+ * and the CC of each input is sent at the last frame of every hop its value changed in.
+ *
+ * When built with MOD_RUN_STATS, the cost of each run is recorded, see runstats.h.
+ */
+
+#ifndef PEAKTOCC_H_INCLUDED
+#define PEAKTOCC_H_INCLUDED
+
+#include <lv2/lv2plug.in/ns/lv2core/lv2.h>
+#include <lv2/lv2plug.in/ns/ext/atom/util.h>
+#include <lv2/lv2plug.in/ns/ext/buf-size/buf-size.h>
+#include <lv2/lv2plug.in/ns/ext/midi/midi.h>
+#include <lv2/lv2plug.in/ns/ext/options/options.h>
+#include <lv2/lv2plug.in/ns/ext/urid/urid.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "multimeter.h"
+#include "spillqueue.h"
+
+#ifdef MOD_RUN_STATS
+# include "runstats.h"
+#endif
+
+#ifndef PEAK_TO_CC_URI
+# error PEAK_TO_CC_URI undefined
+#endif
+#ifndef PEAK_TO_CC_CHANNELS
+# error PEAK_TO_CC_CHANNELS undefined
+#endif
+
+#if PEAK_TO_CC_CHANNELS < 1 || PEAK_TO_CC_CHANNELS > MULTI_METER_MAX_CHANNELS
+# error invalid peak-to-cc channel count
+#endif
+
+// meter analysis hop used when the host does not tell its block length, and the range allowed for it,
+// the same as the single channel peak-to-cc
+#define PEAK_TO_CC_DEFAULT_HOP 128
+#define PEAK_TO_CC_MIN_HOP     16
+#define PEAK_TO_CC_MAX_HOP     4096
+
+// peak hold time in seconds and fallback rate in dB/s
+#define PEAK_TO_CC_HOLD 0.25f
+#define PEAK_TO_CC_FALL 30.0f
+
+typedef enum {
+    PORT_AUDIO_IN1 = 0,
+    PORT_ATOM_OUT = PORT_AUDIO_IN1 + PEAK_TO_CC_CHANNELS,
+    PORT_CONTROL_DROPPED,
+    PORT_CONTROL_DEFERRED,
+    PORT_CONTROL_DETECTOR,
+    PORT_CONTROL_INTERVAL,
+    PORT_CONTROL_IN1_CC, // followed by channel, then CC and channel for each other input
+    PORT_CONTROL_IN1_CHANNEL,
+    PORT_COUNT = PORT_CONTROL_IN1_CC + 2 * PEAK_TO_CC_CHANNELS
+} PortEnum;
+
+// Struct for a 3 byte MIDI event
+typedef struct {
+    LV2_Atom_Event event;
+    uint8_t        msg[3];
+} LV2_Atom_MIDI;
+
+typedef struct {
+    // all inputs, metered together
+    MultiMeter meter;
+
+    // history, send data when changes happen
+    int prev_status[PEAK_TO_CC_CHANNELS];
+    int prev_cc_num[PEAK_TO_CC_CHANNELS];
+    int prev_cc_value[PEAK_TO_CC_CHANNELS];
+
+    // meter setup, the hop does not change with the size of each run
+    uint32_t sample_rate;
+    uint32_t block_hop; // from the host block length
+    uint32_t hop;       // in use, the update interval control or block_hop
+
+    // URIDs
+    LV2_URID urid_atomSequence;
+    LV2_URID urid_midiEvent;
+
+    // data flow ports
+    const float* port_audio_in[PEAK_TO_CC_CHANNELS];
+    LV2_Atom_Sequence* port_events_out;
+
+    // control ports
+    const float* port_detector;
+    const float* port_interval;
+    const float* port_cc[PEAK_TO_CC_CHANNELS];
+    const float* port_channel[PEAK_TO_CC_CHANNELS];
+
+    // control output ports
+    float* port_dropped;
+    float* port_deferred;
+
+    // events that did not fit on the output
+    SpillQueue spill;
+
+#ifdef MOD_RUN_STATS
+    RunStats* stats;
+#endif
+} Data;
+
+static inline int peak_to_cc_midimax(const int v)
+{
+    return v > 127 ? 127 : v;
+}
+
+// meter hop for the update interval control, 0 follows the host block length
+static inline uint32_t peak_to_cc_control_hop(const Data* const self)
+{
+    const int hop = (int)(*self->port_interval + 0.5f);
+
+    if (hop <= 0)
+        return self->block_hop;
+
+    return hop < PEAK_TO_CC_MIN_HOP ? PEAK_TO_CC_MIN_HOP : hop > PEAK_TO_CC_MAX_HOP ? PEAK_TO_CC_MAX_HOP : hop;
+}
+
+// send the CC of input `c` at `frame` if anything about it changed, returns true if an event was written or queued
+static bool peak_to_cc_send(Data* const self, const uint32_t out_capacity, const uint32_t frame,
+                            const uint32_t c, const int status, const int cc_num, const int cc_value)
+{
+    if (self->prev_status[c] == status && self->prev_cc_num[c] == cc_num && self->prev_cc_value[c] == cc_value)
+        return false;
+
+    LV2_Atom_MIDI msg;
+    memset(&msg, 0, sizeof(LV2_Atom_MIDI));
+
+    msg.event.time.frames = frame;
+    msg.event.body.size = 3;
+    msg.event.body.type = self->urid_midiEvent;
+
+    msg.msg[0] = status;
+    msg.msg[1] = cc_num;
+    msg.msg[2] = cc_value;
+
+    self->prev_status[c]   = status;
+    self->prev_cc_num[c]   = cc_num;
+    self->prev_cc_value[c] = cc_value;
+
+    return spill_queue_write(&self->spill, self->port_events_out, out_capacity, (LV2_Atom_Event*)&msg);
+}
+
+static LV2_Handle instantiate(const LV2_Descriptor*     descriptor,
+                              double                    rate,
+                              const char*               path,
+                              const LV2_Feature* const* features)
+{
+    Data* self = (Data*)calloc(1, sizeof(Data));
+
+    // Get host features
+    const LV2_URID_Map* map = NULL;
+    const LV2_Options_Option* options = NULL;
+
+    for (int i = 0; features[i]; ++i) {
+        if (!strcmp(features[i]->URI, LV2_URID__map)) {
+            map = (const LV2_URID_Map*)features[i]->data;
+        } else if (!strcmp(features[i]->URI, LV2_OPTIONS__options)) {
+            options = (const LV2_Options_Option*)features[i]->data;
+        }
+    }
+    if (!map) {
+        free(self);
+        return NULL;
+    }
+
+#ifdef MOD_RUN_STATS
+    self->stats = run_stats_new();
+
+    if (!self->stats) {
+        free(self);
+        return NULL;
+    }
+#endif
+
+    // Map URIs
+    self->urid_atomSequence = map->map(map->handle, LV2_ATOM__Sequence);
+    self->urid_midiEvent    = map->map(map->handle, LV2_MIDI__MidiEvent);
+
+    // Meter hop, the nominal block length if known, or else the maximum one
+    int nominal_block_length = 0;
+    int max_block_length = 0;
+
+    if (options) {
+        const LV2_URID urid_atomInt                   = map->map(map->handle, LV2_ATOM__Int);
+        const LV2_URID urid_bufSizeMaxBlockLength     = map->map(map->handle, LV2_BUF_SIZE__maxBlockLength);
+        const LV2_URID urid_bufSizeNominalBlockLength = map->map(map->handle, LV2_BUF_SIZE__nominalBlockLength);
+
+        for (int i = 0; options[i].key != 0; ++i) {
+            if (options[i].type != urid_atomInt)
+                continue;
+
+            if (options[i].key == urid_bufSizeNominalBlockLength)
+                nominal_block_length = *(const int32_t*)options[i].value;
+            else if (options[i].key == urid_bufSizeMaxBlockLength)
+                max_block_length = *(const int32_t*)options[i].value;
+        }
+    }
+
+    const int block_hop = nominal_block_length > 0 ? nominal_block_length
+                        : max_block_length > 0     ? max_block_length
+                        : PEAK_TO_CC_DEFAULT_HOP;
+
+    self->sample_rate = (uint32_t)(rate + 0.5);
+    self->block_hop = block_hop < PEAK_TO_CC_MIN_HOP ? PEAK_TO_CC_MIN_HOP
+                    : block_hop > PEAK_TO_CC_MAX_HOP ? PEAK_TO_CC_MAX_HOP
+                    : (uint32_t)block_hop;
+    self->hop = self->block_hop;
+
+    multi_meter_select_kernel(&self->meter, MULTI_METER_KERNEL_AUTO);
+
+    return self;
+}
+
+static void connect_port(LV2_Handle instance, uint32_t port, void* data)
+{
+    Data* self = (Data*)instance;
+
+    if (port < PORT_ATOM_OUT)
+    {
+        self->port_audio_in[port - PORT_AUDIO_IN1] = (const float*)data;
+        return;
+    }
+    if (port >= PORT_CONTROL_IN1_CC && port < PORT_COUNT)
+    {
+        const uint32_t c = (port - PORT_CONTROL_IN1_CC) / 2;
+
+        if ((port - PORT_CONTROL_IN1_CC) % 2 == 0)
+            self->port_cc[c] = (const float*)data;
+        else
+            self->port_channel[c] = (const float*)data;
+        return;
+    }
+
+    switch (port)
+    {
+    case PORT_ATOM_OUT:
+            self->port_events_out = (LV2_Atom_Sequence*)data;
+            break;
+    case PORT_CONTROL_DROPPED:
+            self->port_dropped = (float*)data;
+            break;
+    case PORT_CONTROL_DEFERRED:
+            self->port_deferred = (float*)data;
+            break;
+    case PORT_CONTROL_DETECTOR:
+            self->port_detector = (const float*)data;
+            break;
+    case PORT_CONTROL_INTERVAL:
+            self->port_interval = (const float*)data;
+            break;
+    }
+}
+
+static void activate(LV2_Handle instance)
+{
+    Data* self = (Data*)instance;
+
+    for (uint32_t c = 0; c < PEAK_TO_CC_CHANNELS; ++c)
+    {
+        self->prev_status[c] = -1;
+        self->prev_cc_num[c] = -1;
+        self->prev_cc_value[c] = -1;
+    }
+
+    multi_meter_init(&self->meter, PEAK_TO_CC_CHANNELS, self->sample_rate, self->hop, PEAK_TO_CC_HOLD, PEAK_TO_CC_FALL);
+
+    spill_queue_reset(&self->spill);
+}
+
+static void run(LV2_Handle instance, uint32_t sample_count)
+{
+    Data* self = (Data*)instance;
+
+#ifdef MOD_RUN_STATS
+    const uint64_t run_start = run_stats_ticks();
+    uint32_t events = 0;
+#endif
+
+    multi_meter_set_detector(&self->meter, (int)(*self->port_detector + 0.5f));
+
+    const uint32_t hop = peak_to_cc_control_hop(self);
+
+    if (hop != self->hop)
+    {
+        self->hop = hop;
+        multi_meter_set_hop(&self->meter, hop);
+    }
+
+    int status[PEAK_TO_CC_CHANNELS], cc_num[PEAK_TO_CC_CHANNELS];
+
+    for (uint32_t c = 0; c < PEAK_TO_CC_CHANNELS; ++c)
+    {
+        const int channel = (int)(*self->port_channel[c] + 0.5f);
+
+        status[c] = LV2_MIDI_MSG_CONTROLLER | ((channel < 1 ? 1 : channel > 16 ? 16 : channel) - 1);
+        cc_num[c] = (int)(*self->port_cc[c] + 0.5f);
+    }
+
+    // Get the capacity
+    const uint32_t out_capacity = self->port_events_out->atom.size;
+
+    // Write an empty Sequence header to the output port
+    lv2_atom_sequence_clear(self->port_events_out);
+
+    // Set port type
+    self->port_events_out->atom.type = self->urid_atomSequence;
+
+    // Send what did not fit last time first
+    spill_queue_flush(&self->spill, self->port_events_out, out_capacity);
+
+    // Meter one hop at a time, the levels only change at the end of a hop,
+    // so that is where the CCs are sent, at its own frame
+    for (uint32_t offset = 0; offset < sample_count;)
+    {
+        const uint32_t remaining = multi_meter_hop_remaining(&self->meter);
+        const uint32_t frames = remaining < sample_count - offset ? remaining : sample_count - offset;
+
+        multi_meter_process(&self->meter, self->port_audio_in, offset, frames);
+        offset += frames;
+
+        if (frames != remaining)
+            break;
+
+        for (uint32_t c = 0; c < PEAK_TO_CC_CHANNELS; ++c)
+        {
+            const int cc_value = peak_to_cc_midimax((int)(fabsf(self->meter.level[c]) * 127.0f));
+
+            if (peak_to_cc_send(self, out_capacity, offset - 1, c, status[c], cc_num[c], cc_value))
+            {
+#ifdef MOD_RUN_STATS
+                ++events;
+#endif
+            }
+        }
+    }
+
+    *self->port_dropped  = self->spill.dropped;
+    *self->port_deferred = self->spill.deferred;
+
+#ifdef MOD_RUN_STATS
+    run_stats_end(self->stats, run_start, sample_count, events);
+#endif
+}
+
+static void cleanup(LV2_Handle instance)
+{
+#ifdef MOD_RUN_STATS
+    run_stats_free(((Data*)instance)->stats);
+#endif
+    free(instance);
+}
+
+#ifdef MOD_RUN_STATS
+static bool snapshot_run_stats(LV2_Handle instance, RunStats* stats)
+{
+    return run_stats_snapshot(((Data*)instance)->stats, stats);
+}
+#endif
+
+static const void* extension_data(const char* uri)
+{
+#ifdef MOD_RUN_STATS
+    static const MOD_Run_Stats_Interface run_stats = { snapshot_run_stats };
+
+    if (!strcmp(uri, MOD_RUN_STATS__interface))
+        return &run_stats;
+#endif
+
+    return NULL;
+}
+
+static const LV2_Descriptor descriptor = {
+    .URI = PEAK_TO_CC_URI,
+    .instantiate = instantiate,
+    .connect_port = connect_port,
+    .activate = activate,
+    .run = run,
+    .deactivate = NULL,
+    .cleanup = cleanup,
+    .extension_data = extension_data
+};
+
+#ifdef MOD_BUNDLE_DESCRIPTOR
+// built as part of the combined bundle, see mod-midi-utilities.lv2
+__attribute__((visibility("hidden")))
+const LV2_Descriptor* MOD_BUNDLE_DESCRIPTOR(void)
+{
+    return &descriptor;
+}
+#else
+LV2_SYMBOL_EXPORT
+const LV2_Descriptor* lv2_descriptor(uint32_t index)
+{
+    return (index == 0) ? &descriptor : NULL;
+}
+#endif
+
+#endif // PEAKTOCC_H_INCLUDED
@@ -0,0 +1,138 @@
+/*
+ * Per-instance run() cost statistics, only built when MOD_RUN_STATS is defined (`make RUN_STATS=true`).
+ *
+ * The plugin updates the stats at the end of each run, a non-RT reader takes a consistent copy at any time
+ * through the plugin extension data, without locking. The stats are kept in their own cache line,
+ * away from the plugin data used by run().
+ * Times are in ticks of the CPU cycle counter, or nanoseconds on platforms without one.
+ */
+
+#ifndef RUNSTATS_H_INCLUDED
+#define RUNSTATS_H_INCLUDED
+
+#include <lv2/lv2plug.in/ns/lv2core/lv2.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(__x86_64__) && !defined(__i386__) && !defined(__aarch64__)
+# include <time.h>
+#endif
+
+#define MOD_RUN_STATS__interface "http://moddevices.com/ns/mod-midi-utilities#runStatsInterface"
+
+// histogram buckets, bucket `i` counts runs that took between 2^i and 2^(i+1) ticks
+#define RUN_STATS_BUCKETS 40
+
+typedef struct {
+    uint32_t sequence; // odd while being updated
+    uint32_t runs;
+    uint64_t frames;
+    uint64_t events;
+    uint64_t total_ticks;
+    uint64_t max_ticks;
+    uint32_t histogram[RUN_STATS_BUCKETS];
+} __attribute__((aligned(64))) RunStats;
+
+// extension data interface
+typedef struct {
+    // copy the current stats of `instance` into `stats`, returns false if it kept changing while copying
+    bool (*snapshot)(LV2_Handle instance, RunStats* stats);
+} MOD_Run_Stats_Interface;
+
+static inline uint64_t run_stats_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// calloc does not guarantee cache line alignment, so the stats are aligned by hand
+// with the start of the allocation kept right before them
+static inline RunStats* run_stats_new(void)
+{
+    uint8_t* const allocation = (uint8_t*)calloc(1, sizeof(RunStats) + 64 + sizeof(void*));
+
+    if (allocation == NULL)
+        return NULL;
+
+    const uintptr_t aligned = ((uintptr_t)(allocation + sizeof(void*)) + 63) & ~(uintptr_t)63;
+    ((void**)aligned)[-1] = allocation;
+
+    return (RunStats*)aligned;
+}
+
+static inline void run_stats_free(RunStats* const stats)
+{
+    if (stats != NULL)
+        free(((void**)stats)[-1]);
+}
+
+// record a run that started at `start` ticks, called at the end of run
+static inline void run_stats_end(RunStats* const stats, const uint64_t start, const uint32_t frames, const uint32_t events)
+{
+    const uint64_t ticks = run_stats_ticks() - start;
+    const uint32_t bucket = ticks > 1 ? 63 - __builtin_clzll(ticks) : 0;
+
+    __atomic_store_n(&stats->sequence, stats->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    ++stats->runs;
+    stats->frames += frames;
+    stats->events += events;
+    stats->total_ticks += ticks;
+    if (ticks > stats->max_ticks)
+        stats->max_ticks = ticks;
+    ++stats->histogram[bucket < RUN_STATS_BUCKETS ? bucket : RUN_STATS_BUCKETS - 1];
+
+    __atomic_store_n(&stats->sequence, stats->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// consistent copy of `stats` from a non-RT thread
+static inline bool run_stats_snapshot(const RunStats* const stats, RunStats* const copy)
+{
+    for (int tries = 0; tries < 100; ++tries)
+    {
+        const uint32_t sequence = __atomic_load_n(&stats->sequence, __ATOMIC_ACQUIRE);
+
+        if (sequence & 1)
+            continue;
+
+        memcpy(copy, stats, sizeof(RunStats));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&stats->sequence, __ATOMIC_RELAXED) == sequence)
+            return true;
+    }
+
+    return false;
+}
+
+// upper bound of the run time under which `fraction` of the runs in `stats` took, in ticks
+static inline uint64_t run_stats_percentile(const RunStats* const stats, const double fraction)
+{
+    const uint64_t target = (uint64_t)(stats->runs * fraction + 0.5);
+    uint64_t count = 0;
+
+    for (uint32_t i = 0; i < RUN_STATS_BUCKETS; ++i)
+    {
+        count += stats->histogram[i];
+
+        if (count >= target && count != 0)
+            return 2ull << i;
+    }
+
+    return stats->max_ticks;
+}
+
+#endif // RUNSTATS_H_INCLUDED
@@ -0,0 +1,85 @@
+/*
+ * Fixed-size queue for events that did not fit in an output atom sequence.
+ *
+ * Instead of silently losing events when the host buffer is full, they are kept here
+ * and written at the start of the next run, in the same order.
+ * Only events that do not fit in the queue, or are too big for it, are dropped.
+ * Both cases are counted, so plugins can report them.
+ */
+
+#ifndef SPILLQUEUE_H_INCLUDED
+#define SPILLQUEUE_H_INCLUDED
+
+#include <lv2/lv2plug.in/ns/ext/atom/util.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SPILL_QUEUE_SIZE           128 // max number of pending events
+#define SPILL_QUEUE_MAX_EVENT_SIZE 16  // max body size of a single event, bigger events are dropped
+
+typedef struct {
+    LV2_Atom_Event event;
+    uint8_t        data[SPILL_QUEUE_MAX_EVENT_SIZE];
+} SpillEvent;
+
+typedef struct {
+    SpillEvent events[SPILL_QUEUE_SIZE];
+    uint32_t head;  // index of the oldest pending event
+    uint32_t count; // number of pending events
+
+    // totals since last reset
+    uint32_t dropped;
+    uint32_t deferred;
+} SpillQueue;
+
+static inline void spill_queue_reset(SpillQueue* const queue)
+{
+    queue->head = queue->count = 0;
+    queue->dropped = queue->deferred = 0;
+}
+
+// write pending events to the start of `out`, must be called right after clearing it
+static inline void spill_queue_flush(SpillQueue* const queue, LV2_Atom_Sequence* const out, const uint32_t capacity)
+{
+    while (queue->count != 0)
+    {
+        SpillEvent* const spill = &queue->events[queue->head];
+
+        // events are late already, send them as soon as possible
+        spill->event.time.frames = 0;
+
+        if (lv2_atom_sequence_append_event(out, capacity, &spill->event) == NULL)
+            break;
+
+        queue->head = (queue->head + 1) % SPILL_QUEUE_SIZE;
+        --queue->count;
+    }
+}
+
+// append `ev` to `out`, or keep it for the next run if `out` is full or older events are still pending.
+// returns false if the event was dropped.
+static inline bool spill_queue_write(SpillQueue* const queue,
+                                     LV2_Atom_Sequence* const out,
+                                     const uint32_t capacity,
+                                     const LV2_Atom_Event* const ev)
+{
+    if (queue->count == 0 && lv2_atom_sequence_append_event(out, capacity, ev) != NULL)
+        return true;
+
+    if (queue->count == SPILL_QUEUE_SIZE || ev->body.size > SPILL_QUEUE_MAX_EVENT_SIZE)
+    {
+        ++queue->dropped;
+        return false;
+    }
+
+    SpillEvent* const spill = &queue->events[(queue->head + queue->count) % SPILL_QUEUE_SIZE];
+    memcpy(spill, ev, sizeof(LV2_Atom_Event) + ev->body.size);
+
+    ++queue->count;
+    ++queue->deferred;
+    return true;
+}
+
+#endif // SPILLQUEUE_H_INCLUDED
@@ -0,0 +1,1332 @@
+/*
+ * Shared MIDI switchbox routing core.
+ *
+ * This file is meant to be included once by each switchbox plugin source,
+ * after defining its topology:
+ *
+ *   SWITCHBOX_URI      plugin URI
+ *   SWITCHBOX_INPUTS   number of selectable inputs per lane
+ *   SWITCHBOX_OUTPUTS  number of selectable outputs per lane
+ *   SWITCHBOX_LANES    number of MIDI streams switched together (default 1)
+ *
+ * One of SWITCHBOX_INPUTS or SWITCHBOX_OUTPUTS must be 1, the target control
+ * selects which of the others is active.
+ *
+ * Ports are laid out as: target, inputs, outputs.
+ * Inputs and outputs are grouped per target position, lanes are consecutive.
+ * For example, a 2-1 switchbox with 2 lanes has ports:
+ *   target, in1 (pos 1, lane 1), in2 (pos 1, lane 2), in3 (pos 2, lane 1), in4 (pos 2, lane 2), out1, out2
+ *
+ * Switchboxes with more than one output also get a "sticky" toggle, appended after the outputs.
+ * When enabled, note-offs and polyphonic aftertouch follow the output that received their note-on.
+ *
+ * Then all switchboxes get the in-band switching controls: mode, channel and CC number.
+ * In Program Change or Control Change mode the target control is ignored, and the target is instead
+ * changed by those messages on the first input, at the exact frame they arrive.
+ * Switch messages are consumed, they are not sent to any output.
+ *
+ * Switchboxes with more than one input then get a "merge" toggle, followed by a channel remap and mute toggle per input.
+ * When merging, the target is ignored and events from all unmuted inputs are interleaved into the output in frame order,
+ * with ties ordered by input number.
+ *
+ * Then all switchboxes have "dropped" and "deferred" output controls, counting events since activation
+ * that were lost or delayed to the next run because an output buffer was full.
+ *
+ * Finally, switchboxes with more than one output get a "channel routing" toggle, followed by the output of each MIDI channel.
+ * When routing by channel, the target and sticky controls are ignored and each channel message is sent to the output
+ * selected for its channel, or nowhere if none is. System messages, including realtime, are sent to all outputs.
+ *
+ * They also get a "zones" toggle, key and velocity overlap controls, then a key range and velocity range per target position.
+ * When zones are enabled (and channel routing is not), each note-on is sent to the outputs whose key and velocity ranges
+ * contain it, note-offs and polyphonic aftertouch follow their note-on, and all other messages are sent to all outputs.
+ * Within the overlap of a range edge a note goes to both sides, with its velocity scaled to crossfade between them.
+ * The zones are compiled into 128-entry tables when their controls change, so routing a note costs the same for any layout.
+ *
+ * When built with MOD_RUN_STATS, the cost of each run is recorded, see runstats.h.
+ *
+ * All topology values are compile-time constants, so the routing below
+ * folds into a plain copy loop per lane, with the route resolved once per block,
+ * or once per segment between in-band switches.
+ */
+
+#ifndef SWITCHBOX_H_INCLUDED
+#define SWITCHBOX_H_INCLUDED
+
+#include <lv2/lv2plug.in/ns/lv2core/lv2.h>
+#include <lv2/lv2plug.in/ns/ext/atom/util.h>
+#include <lv2/lv2plug.in/ns/ext/midi/midi.h>
+#include <lv2/lv2plug.in/ns/ext/urid/urid.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "notetracker.h"
+#include "spillqueue.h"
+
+#ifdef MOD_RUN_STATS
+# include "runstats.h"
+#endif
+
+#ifndef SWITCHBOX_URI
+# error SWITCHBOX_URI undefined
+#endif
+#ifndef SWITCHBOX_INPUTS
+# error SWITCHBOX_INPUTS undefined
+#endif
+#ifndef SWITCHBOX_OUTPUTS
+# error SWITCHBOX_OUTPUTS undefined
+#endif
+#ifndef SWITCHBOX_LANES
+# define SWITCHBOX_LANES 1
+#endif
+
+#if SWITCHBOX_INPUTS < 1 || SWITCHBOX_OUTPUTS < 1 || SWITCHBOX_LANES < 1
+# error invalid switchbox topology
+#endif
+#if SWITCHBOX_INPUTS > 1 && SWITCHBOX_OUTPUTS > 1
+# error switchbox can only switch inputs or outputs, not both
+#endif
+
+#define SWITCHBOX_NUM_INPUT_PORTS  (SWITCHBOX_INPUTS * SWITCHBOX_LANES)
+#define SWITCHBOX_NUM_OUTPUT_PORTS (SWITCHBOX_OUTPUTS * SWITCHBOX_LANES)
+#define SWITCHBOX_NUM_TARGETS      (SWITCHBOX_INPUTS > SWITCHBOX_OUTPUTS ? SWITCHBOX_INPUTS : SWITCHBOX_OUTPUTS)
+
+typedef enum {
+    PORT_CONTROL_TARGET = 0,
+    PORT_ATOM_IN1,
+    PORT_ATOM_OUT1 = PORT_ATOM_IN1 + SWITCHBOX_NUM_INPUT_PORTS,
+#if SWITCHBOX_OUTPUTS > 1
+    PORT_CONTROL_STICKY = PORT_ATOM_OUT1 + SWITCHBOX_NUM_OUTPUT_PORTS,
+    PORT_CONTROL_SWITCH_MODE,
+#else
+    PORT_CONTROL_SWITCH_MODE = PORT_ATOM_OUT1 + SWITCHBOX_NUM_OUTPUT_PORTS,
+#endif
+    PORT_CONTROL_SWITCH_CHANNEL,
+    PORT_CONTROL_SWITCH_CC,
+#if SWITCHBOX_INPUTS > 1
+    PORT_CONTROL_MERGE,
+    PORT_CONTROL_IN1_CHANNEL, // followed by mute, then channel and mute for each other input
+    PORT_CONTROL_IN1_MUTE,
+    PORT_CONTROL_DROPPED = PORT_CONTROL_IN1_CHANNEL + 2 * SWITCHBOX_NUM_INPUT_PORTS,
+#else
+    PORT_CONTROL_DROPPED,
+#endif
+    PORT_CONTROL_DEFERRED,
+#if SWITCHBOX_OUTPUTS > 1
+    PORT_CONTROL_CHANNEL_ROUTING,
+    PORT_CONTROL_CH1_OUTPUT, // followed by the output of each other channel
+    PORT_CONTROL_ZONES = PORT_CONTROL_CH1_OUTPUT + 16,
+    PORT_CONTROL_ZONE_KEY_OVERLAP,
+    PORT_CONTROL_ZONE_VELOCITY_OVERLAP,
+    PORT_CONTROL_ZONE1_KEY_LOW, // followed by key high, velocity low and velocity high, then the same for each other target
+    PORT_COUNT = PORT_CONTROL_ZONE1_KEY_LOW + 4 * SWITCHBOX_OUTPUTS
+#else
+    PORT_COUNT
+#endif
+} PortEnum;
+
+typedef enum {
+    SWITCH_MODE_CONTROL = 0,
+    SWITCH_MODE_PROGRAM_CHANGE,
+    SWITCH_MODE_CONTROL_CHANGE
+} SwitchModeEnum;
+
+// merge settings, a change to any of these releases the notes on the merged outputs
+typedef struct {
+    bool enabled;
+    int channel[SWITCHBOX_NUM_INPUT_PORTS]; // -1 to keep the original channel
+    bool mute[SWITCHBOX_NUM_INPUT_PORTS];
+} SwitchboxMerge;
+
+static inline bool switchbox_merge_changed(const SwitchboxMerge* const a, const SwitchboxMerge* const b)
+{
+    if (a->enabled != b->enabled)
+        return true;
+    if (! a->enabled)
+        return false;
+
+    for (uint32_t i = 0; i < SWITCHBOX_NUM_INPUT_PORTS; ++i)
+    {
+        if (a->channel[i] != b->channel[i] || a->mute[i] != b->mute[i])
+            return true;
+    }
+
+    return false;
+}
+
+// channel routing settings, a change to any of these releases the notes of the channels that moved
+typedef struct {
+    bool enabled;
+    int output[16]; // target position of each channel, -1 for none
+} SwitchboxChannelRouting;
+
+static inline bool switchbox_channel_routing_changed(const SwitchboxChannelRouting* const a,
+                                                     const SwitchboxChannelRouting* const b)
+{
+    if (a->enabled != b->enabled)
+        return true;
+    if (! a->enabled)
+        return false;
+
+    for (uint8_t c = 0; c < 16; ++c)
+    {
+        if (a->output[c] != b->output[c])
+            return true;
+    }
+
+    return false;
+}
+
+// zone settings, a change to any of these recompiles the zone tables
+typedef struct {
+    bool enabled;
+    int key_overlap;
+    int velocity_overlap;
+    int key_low[SWITCHBOX_OUTPUTS];
+    int key_high[SWITCHBOX_OUTPUTS];
+    int velocity_low[SWITCHBOX_OUTPUTS];
+    int velocity_high[SWITCHBOX_OUTPUTS];
+} SwitchboxZones;
+
+static inline bool switchbox_zones_changed(const SwitchboxZones* const a, const SwitchboxZones* const b)
+{
+    if (a->enabled != b->enabled)
+        return true;
+    if (! a->enabled)
+        return false;
+    if (a->key_overlap != b->key_overlap || a->velocity_overlap != b->velocity_overlap)
+        return true;
+
+    for (uint32_t t = 0; t < SWITCHBOX_OUTPUTS; ++t)
+    {
+        if (a->key_low[t] != b->key_low[t] || a->key_high[t] != b->key_high[t] ||
+            a->velocity_low[t] != b->velocity_low[t] || a->velocity_high[t] != b->velocity_high[t])
+            return true;
+    }
+
+    return false;
+}
+
+// zone layout compiled per key and per velocity
+typedef struct {
+    uint8_t key_mask[128];      // bitset of the targets each key is sent to
+    uint8_t velocity_mask[128]; // bitset of the targets each velocity is sent to
+    float key_gain[128][SWITCHBOX_OUTPUTS];
+    float velocity_gain[128][SWITCHBOX_OUTPUTS];
+} SwitchboxZoneTable;
+
+// maximum number of in-band target changes handled per run, later ones replace the last
+#define SWITCHBOX_MAX_SWITCHES 32
+
+typedef struct {
+    int64_t frame;
+    int target;
+} SwitchboxSwitch;
+
+typedef struct {
+
+    int previous_target;
+    bool previous_sticky;
+    SwitchboxMerge previous_merge;
+    SwitchboxChannelRouting previous_channel_routing;
+    SwitchboxZones previous_zones;
+
+    // in-band switch settings for the current run
+    SwitchModeEnum switch_mode;
+    int switch_channel; // -1 for any
+    int switch_cc;
+
+    // in-band target changes in the current run
+    SwitchboxSwitch switches[SWITCHBOX_MAX_SWITCHES];
+    uint32_t num_switches;
+
+    // URIDs
+    LV2_URID urid_midiEvent;
+
+    // control ports
+    const float* port_target;
+    const float* port_sticky;
+    const float* port_switch_mode;
+    const float* port_switch_channel;
+    const float* port_switch_cc;
+    const float* port_merge;
+    const float* port_merge_channel[SWITCHBOX_NUM_INPUT_PORTS];
+    const float* port_merge_mute[SWITCHBOX_NUM_INPUT_PORTS];
+    const float* port_channel_routing;
+    const float* port_channel_output[16];
+    const float* port_zones;
+    const float* port_zone_key_overlap;
+    const float* port_zone_velocity_overlap;
+    const float* port_zone_key_low[SWITCHBOX_OUTPUTS];
+    const float* port_zone_key_high[SWITCHBOX_OUTPUTS];
+    const float* port_zone_velocity_low[SWITCHBOX_OUTPUTS];
+    const float* port_zone_velocity_high[SWITCHBOX_OUTPUTS];
+    float* port_dropped;
+    float* port_deferred;
+
+    // atom ports
+    const LV2_Atom_Sequence* port_events_in[SWITCHBOX_NUM_INPUT_PORTS];
+    LV2_Atom_Sequence* port_events_out[SWITCHBOX_NUM_OUTPUT_PORTS];
+
+    // capacity of each output for the current run
+    uint32_t out_capacity[SWITCHBOX_NUM_OUTPUT_PORTS];
+
+    // notes sounding on each output
+    NoteTracker notes[SWITCHBOX_NUM_OUTPUT_PORTS];
+
+    // events that did not fit on each output
+    SpillQueue spill[SWITCHBOX_NUM_OUTPUT_PORTS];
+
+#if SWITCHBOX_OUTPUTS > 1
+    // output index + 1 that received the note-on of each note, 0 if none; only kept in sticky mode
+    uint8_t note_owner[SWITCHBOX_LANES][16][128];
+
+    // current zone layout, and bitset of the targets that received the note-on of each note; only kept with zones enabled
+    SwitchboxZoneTable zone_table;
+    uint8_t zone_notes[SWITCHBOX_LANES][16][128];
+#endif
+
+#ifdef MOD_RUN_STATS
+    RunStats* stats;
+#endif
+} Data;
+
+// Struct for a 3 byte MIDI event
+typedef struct {
+    LV2_Atom_Event event;
+    uint8_t        msg[3];
+} LV2_Atom_MIDI;
+
+// input port used by `lane` when `target` is selected
+static inline uint32_t switchbox_input_index(int target, uint32_t lane)
+{
+    return (SWITCHBOX_INPUTS > 1 ? (uint32_t)target * SWITCHBOX_LANES : 0) + lane;
+}
+
+// output port used by `lane` when `target` is selected
+static inline uint32_t switchbox_output_index(int target, uint32_t lane)
+{
+    return (SWITCHBOX_OUTPUTS > 1 ? (uint32_t)target * SWITCHBOX_LANES : 0) + lane;
+}
+
+// whether output `o` is used when `target` is selected
+static inline bool switchbox_output_is_routed(int target, uint32_t o)
+{
+    return SWITCHBOX_OUTPUTS == 1 || o / SWITCHBOX_LANES == (uint32_t)target;
+}
+
+static inline int switchbox_target_from_control(float value)
+{
+    const int target = (int)value;
+
+    if (target < 0)
+        return 0;
+    if (target >= SWITCHBOX_NUM_TARGETS)
+        return SWITCHBOX_NUM_TARGETS - 1;
+    return target;
+}
+
+// target requested by an in-band switch message, or -1 if `ev` is not one
+static inline int switchbox_switch_target(const Data* const self, const LV2_Atom_Event* const ev)
+{
+    if (self->switch_mode == SWITCH_MODE_CONTROL || ev->body.type != self->urid_midiEvent)
+        return -1;
+
+    const uint8_t* const msg = (const uint8_t*)(ev + 1);
+
+    if (self->switch_channel >= 0 && (msg[0] & 0x0F) != self->switch_channel)
+        return -1;
+
+    switch (self->switch_mode)
+    {
+    case SWITCH_MODE_PROGRAM_CHANGE:
+        if (ev->body.size == 2 && (msg[0] & 0xF0) == 0xC0)
+            return msg[1] < SWITCHBOX_NUM_TARGETS ? msg[1] : SWITCHBOX_NUM_TARGETS - 1;
+        break;
+    case SWITCH_MODE_CONTROL_CHANGE:
+        // the CC range is split evenly between targets
+        if (ev->body.size == 3 && (msg[0] & 0xF0) == 0xB0 && msg[1] == self->switch_cc)
+            return (msg[2] & 0x7F) * SWITCHBOX_NUM_TARGETS / 128;
+        break;
+    default:
+        break;
+    }
+
+    return -1;
+}
+
+// whether `ev` from input `in` should be sent to an output
+static inline bool switchbox_is_routed_event(const Data* const self,
+                                             const LV2_Atom_Sequence* const in,
+                                             const LV2_Atom_Event* const ev)
+{
+    if (ev->body.type != self->urid_midiEvent)
+        return false;
+
+    // switch messages are consumed
+    return in != self->port_events_in[0] || switchbox_switch_target(self, ev) < 0;
+}
+
+// first event of `in` at or after `frame`
+static inline const LV2_Atom_Event* switchbox_seek(const LV2_Atom_Sequence* const in, const int64_t frame)
+{
+    const LV2_Atom_Event* ev = lv2_atom_sequence_begin(&in->body);
+
+    while (! lv2_atom_sequence_is_end(&in->body, in->atom.size, ev) && ev->time.frames < frame)
+        ev = lv2_atom_sequence_next(ev);
+
+    return ev;
+}
+
+// whether `ev` is still part of the segment of `in` ending at `end`
+static inline bool switchbox_in_segment(const LV2_Atom_Sequence* const in,
+                                        const LV2_Atom_Event* const ev,
+                                        const int64_t end)
+{
+    return ! lv2_atom_sequence_is_end(&in->body, in->atom.size, ev) && ev->time.frames < end;
+}
+
+// write an event to output `o`, keeping track of the notes sounding on it
+static inline void switchbox_write(Data* const self, const uint32_t o, const LV2_Atom_Event* const ev)
+{
+    if (spill_queue_write(&self->spill[o], self->port_events_out[o], self->out_capacity[o], ev))
+        note_tracker_process(&self->notes[o], (const uint8_t*)(ev + 1), ev->body.size);
+}
+
+// append a run of consecutive events, already padded, to the end of `out`
+static inline void switchbox_copy_run(LV2_Atom_Sequence* const out, const uint8_t* const begin, const uint8_t* const end)
+{
+    const uint32_t size = (uint32_t)(end - begin);
+
+    memcpy(lv2_atom_sequence_end(&out->body, out->atom.size), begin, size);
+    out->atom.size += lv2_atom_pad_size(size);
+}
+
+// copy the MIDI events of `in` from `ev` until frame `end` to output `o`, which must have room for the whole input sequence.
+// consecutive MIDI events are copied in one go, so usually the whole sequence is a single memcpy.
+static void switchbox_copy_events(Data* const self, const LV2_Atom_Sequence* const in,
+                                  const LV2_Atom_Event* ev, const int64_t end, const uint32_t o)
+{
+    LV2_Atom_Sequence* const out = self->port_events_out[o];
+    NoteTracker* const tracker = &self->notes[o];
+    const uint8_t* run = NULL;
+
+    for (; switchbox_in_segment(in, ev, end); ev = lv2_atom_sequence_next(ev))
+    {
+        if (switchbox_is_routed_event(self, in, ev))
+        {
+            if (run == NULL)
+                run = (const uint8_t*)ev;
+
+            note_tracker_process(tracker, (const uint8_t*)(ev + 1), ev->body.size);
+        }
+        else if (run != NULL)
+        {
+            switchbox_copy_run(out, run, (const uint8_t*)ev);
+            run = NULL;
+        }
+    }
+
+    if (run != NULL)
+    {
+        const uint8_t* const in_end = (const uint8_t*)&in->body + in->atom.size;
+        const uint8_t* const run_end = (const uint8_t*)ev;
+
+        switchbox_copy_run(out, run, run_end < in_end ? run_end : in_end);
+    }
+}
+
+// send note-offs for the notes still sounding on channel `c` of output `o`, and release its sustain pedal
+static void switchbox_release_channel(Data* const self, const uint32_t o, const uint8_t c, const int64_t frame)
+{
+    NoteTracker* const tracker = &self->notes[o];
+
+    if (! note_tracker_is_active(tracker, c))
+        return;
+
+    LV2_Atom_MIDI msg;
+    memset(&msg, 0, sizeof(LV2_Atom_MIDI));
+
+    msg.event.time.frames = frame;
+    msg.event.body.size = 3;
+    msg.event.body.type = self->urid_midiEvent;
+    msg.msg[0] = 0x80 | c;
+
+    for (uint8_t i = 0; i < 4; ++i)
+    {
+        for (uint32_t bits = tracker->notes[c][i]; bits != 0; bits &= bits - 1)
+        {
+            msg.msg[1] = (i << 5) | __builtin_ctz(bits);
+            spill_queue_write(&self->spill[o],
+                    self->port_events_out[o],
+                    self->out_capacity[o],
+                    (LV2_Atom_Event*)&msg);
+        }
+    }
+
+    if (tracker->sustain & (1 << c))
+    {
+        msg.msg[0] = 0xb0 | c;
+        msg.msg[1] = 0x40; // sustain pedal
+        spill_queue_write(&self->spill[o],
+                self->port_events_out[o],
+                self->out_capacity[o],
+                (LV2_Atom_Event*)&msg);
+    }
+
+    memset(tracker->notes[c], 0, sizeof(tracker->notes[c]));
+    tracker->sustain &= ~(1 << c);
+}
+
+// send note-offs for the notes still sounding on output `o`, and release its sustain pedals
+static void switchbox_release_notes(Data* const self, const uint32_t o, const int64_t frame)
+{
+    for (uint8_t c = 0; c < 16; ++c)
+        switchbox_release_channel(self, o, c, frame);
+}
+
+// release the notes of the outputs of `lane` that are not used by `target`
+static void switchbox_release_lane(Data* const self, const uint32_t lane, const int target, const int64_t frame)
+{
+    for (int t = 0; t < SWITCHBOX_OUTPUTS; ++t)
+    {
+        if (SWITCHBOX_OUTPUTS == 1 || t != target)
+            switchbox_release_notes(self, switchbox_output_index(t, lane), frame);
+    }
+}
+
+// find in-band target changes on the first input
+static void switchbox_collect_switches(Data* const self, int target)
+{
+    self->num_switches = 0;
+
+    if (self->switch_mode == SWITCH_MODE_CONTROL)
+        return;
+
+    LV2_ATOM_SEQUENCE_FOREACH(self->port_events_in[0], ev)
+    {
+        const int new_target = switchbox_switch_target(self, ev);
+
+        if (new_target < 0 || new_target == target)
+            continue;
+
+        if (self->num_switches == SWITCHBOX_MAX_SWITCHES)
+            --self->num_switches;
+
+        self->switches[self->num_switches].frame = ev->time.frames;
+        self->switches[self->num_switches].target = new_target;
+        ++self->num_switches;
+        target = new_target;
+    }
+}
+
+#if SWITCHBOX_OUTPUTS > 1
+// take ownership of the notes already sounding when entering sticky mode
+static void switchbox_claim_notes(Data* const self)
+{
+    memset(self->note_owner, 0, sizeof(self->note_owner));
+
+    for (uint32_t o = 0; o < SWITCHBOX_NUM_OUTPUT_PORTS; ++o)
+    {
+        const NoteTracker* const tracker = &self->notes[o];
+
+        for (uint8_t c = 0; c < 16; ++c)
+            for (uint8_t i = 0; i < 4; ++i)
+                for (uint32_t bits = tracker->notes[c][i]; bits != 0; bits &= bits - 1)
+                    self->note_owner[o % SWITCHBOX_LANES][c][(i << 5) | __builtin_ctz(bits)] = o + 1;
+    }
+}
+
+// route one lane in sticky mode from `ev` until frame `end`, `o` is the output currently selected by the target
+static void switchbox_run_sticky(Data* const self, const uint32_t lane, const LV2_Atom_Sequence* const in,
+                                 const LV2_Atom_Event* ev, const int64_t end, const uint32_t o)
+{
+    for (; switchbox_in_segment(in, ev, end); ev = lv2_atom_sequence_next(ev))
+    {
+        if (! switchbox_is_routed_event(self, in, ev))
+            continue;
+
+        if (ev->body.size != 3)
+        {
+            switchbox_write(self, o, ev);
+            continue;
+        }
+
+        const uint8_t* const msg = (const uint8_t*)(ev + 1);
+        const uint8_t channel = msg[0] & 0x0F;
+        uint8_t* const owner = &self->note_owner[lane][channel][msg[1] & 0x7F];
+        const uint32_t owner_out = *owner != 0 ? (uint32_t)*owner - 1 : o;
+
+        switch (msg[0] & 0xF0)
+        {
+        case 0x90:
+            if (msg[2] != 0)
+            {
+                // retriggered while still held on another output, end that one first
+                if (owner_out != o)
+                {
+                    LV2_Atom_MIDI off;
+                    memcpy(&off, ev, sizeof(LV2_Atom_MIDI));
+                    off.msg[0] = 0x80 | channel;
+                    off.msg[2] = 0;
+                    switchbox_write(self, owner_out, (LV2_Atom_Event*)&off);
+                }
+                *owner = o + 1;
+                switchbox_write(self, o, ev);
+                break;
+            }
+            switchbox_write(self, owner_out, ev);
+            *owner = 0;
+            break;
+
+        case 0x80:
+            switchbox_write(self, owner_out, ev);
+            *owner = 0;
+            break;
+
+        case 0xA0:
+            switchbox_write(self, owner_out, ev);
+            break;
+
+        case 0xB0:
+            // pedal releases and note-off controllers also go to the other outputs still holding notes
+            if ((msg[1] == 0x40 && msg[2] < 64) || msg[1] == 0x78 || msg[1] == 0x7B)
+            {
+                for (uint32_t t = 0; t < SWITCHBOX_OUTPUTS; ++t)
+                {
+                    const uint32_t other = switchbox_output_index(t, lane);
+
+                    if (other != o && note_tracker_is_active(&self->notes[other], channel))
+                    {
+                        switchbox_write(self, other, ev);
+
+                        if (msg[1] != 0x40)
+                            for (uint8_t n = 0; n < 128; ++n)
+                                if (self->note_owner[lane][channel][n] == other + 1)
+                                    self->note_owner[lane][channel][n] = 0;
+                    }
+                }
+            }
+            switchbox_write(self, o, ev);
+            break;
+
+        default:
+            switchbox_write(self, o, ev);
+            break;
+        }
+    }
+}
+#endif
+
+#if SWITCHBOX_OUTPUTS > 1
+// release the notes of each channel of `lane` on the outputs it is no longer routed to
+static void switchbox_release_moved_channels(Data* const self, const uint32_t lane,
+                                             const SwitchboxChannelRouting* const routing)
+{
+    for (int t = 0; t < SWITCHBOX_OUTPUTS; ++t)
+    {
+        const uint32_t o = switchbox_output_index(t, lane);
+
+        for (uint8_t c = 0; c < 16; ++c)
+        {
+            if (routing->output[c] != t)
+                switchbox_release_channel(self, o, c, 0);
+        }
+    }
+}
+
+// route one lane through the channel table, system messages go to all outputs
+static void switchbox_route_channels(Data* const self, const uint32_t lane,
+                                     const SwitchboxChannelRouting* const routing)
+{
+    const LV2_Atom_Sequence* const in = self->port_events_in[switchbox_input_index(0, lane)];
+
+    LV2_ATOM_SEQUENCE_FOREACH(in, ev)
+    {
+        if (! switchbox_is_routed_event(self, in, ev))
+            continue;
+
+        const uint8_t status = ((const uint8_t*)(ev + 1))[0];
+
+        if (status >= 0xF0)
+        {
+            for (int t = 0; t < SWITCHBOX_OUTPUTS; ++t)
+                switchbox_write(self, switchbox_output_index(t, lane), ev);
+            continue;
+        }
+
+        const int t = routing->output[status & 0x0F];
+
+        if (t >= 0)
+            switchbox_write(self, switchbox_output_index(t, lane), ev);
+    }
+}
+#endif
+
+#if SWITCHBOX_OUTPUTS > 1
+// weight of `value` in the range from `low` to `high`, fading in and out over `overlap` steps on each side of its edges.
+// edges at `min` or 127 do not fade, and the weights of two adjacent ranges always add up to 1.
+static float switchbox_zone_weight(const int value, const int low, const int high, const int overlap, const int min)
+{
+    const float width = 2 * overlap + 1;
+    float weight = 1.0f;
+
+    if (low > min)
+    {
+        const float fade_in = 0.5f + (value - low + 0.5f) / width;
+
+        if (fade_in < weight)
+            weight = fade_in;
+    }
+    if (high < 127)
+    {
+        const float fade_out = 0.5f - (value - high - 0.5f) / width;
+
+        if (fade_out < weight)
+            weight = fade_out;
+    }
+
+    return weight > 0.0f ? weight : 0.0f;
+}
+
+static void switchbox_compile_zones(Data* const self, const SwitchboxZones* const zones)
+{
+    SwitchboxZoneTable* const table = &self->zone_table;
+
+    memset(table, 0, sizeof(SwitchboxZoneTable));
+
+    for (int v = 0; v < 128; ++v)
+    {
+        for (int t = 0; t < SWITCHBOX_OUTPUTS; ++t)
+        {
+            const float key_gain = switchbox_zone_weight(v, zones->key_low[t], zones->key_high[t],
+                                                         zones->key_overlap, 0);
+            // velocity 0 is a note-off, so the velocity range starts at 1
+            const float velocity_gain = switchbox_zone_weight(v, zones->velocity_low[t], zones->velocity_high[t],
+                                                              zones->velocity_overlap, 1);
+
+            table->key_gain[v][t] = key_gain;
+            table->velocity_gain[v][t] = velocity_gain;
+
+            if (key_gain > 0.0f)
+                table->key_mask[v] |= 1 << t;
+            if (velocity_gain > 0.0f)
+                table->velocity_mask[v] |= 1 << t;
+        }
+    }
+}
+
+// take ownership of the notes already sounding when enabling zones
+static void switchbox_claim_zone_notes(Data* const self)
+{
+    memset(self->zone_notes, 0, sizeof(self->zone_notes));
+
+    for (uint32_t o = 0; o < SWITCHBOX_NUM_OUTPUT_PORTS; ++o)
+    {
+        const NoteTracker* const tracker = &self->notes[o];
+
+        for (uint8_t c = 0; c < 16; ++c)
+            for (uint8_t i = 0; i < 4; ++i)
+                for (uint32_t bits = tracker->notes[c][i]; bits != 0; bits &= bits - 1)
+                    self->zone_notes[o % SWITCHBOX_LANES][c][(i << 5) | __builtin_ctz(bits)] |= 1 << (o / SWITCHBOX_LANES);
+    }
+}
+
+// write `ev` to the outputs of `lane` in the `targets` bitset
+static void switchbox_write_targets(Data* const self, const uint32_t lane, uint32_t targets,
+                                    const LV2_Atom_Event* const ev)
+{
+    for (; targets != 0; targets &= targets - 1)
+        switchbox_write(self, switchbox_output_index(__builtin_ctz(targets), lane), ev);
+}
+
+// route one lane through the zone tables
+static void switchbox_route_zones(Data* const self, const uint32_t lane)
+{
+    const SwitchboxZoneTable* const table = &self->zone_table;
+    const LV2_Atom_Sequence* const in = self->port_events_in[switchbox_input_index(0, lane)];
+    const uint32_t all = (1 << SWITCHBOX_OUTPUTS) - 1;
+
+    LV2_ATOM_SEQUENCE_FOREACH(in, ev)
+    {
+        if (! switchbox_is_routed_event(self, in, ev))
+            continue;
+
+        const uint8_t* const msg = (const uint8_t*)(ev + 1);
+
+        if (ev->body.size != 3 || msg[0] >= 0xF0)
+        {
+            switchbox_write_targets(self, lane, all, ev);
+            continue;
+        }
+
+        const uint8_t channel = msg[0] & 0x0F;
+        const uint8_t note = msg[1] & 0x7F;
+        const uint8_t velocity = msg[2] & 0x7F;
+        uint8_t* const held = &self->zone_notes[lane][channel][note];
+
+        switch (msg[0] & 0xF0)
+        {
+        case 0x90:
+            if (velocity != 0)
+            {
+                const uint32_t targets = table->key_mask[note] & table->velocity_mask[velocity];
+
+                // retriggered while still held on outputs it no longer goes to, end it there first
+                if ((*held & ~targets) != 0)
+                {
+                    LV2_Atom_MIDI off;
+                    memcpy(&off, ev, sizeof(LV2_Atom_MIDI));
+                    off.msg[0] = 0x80 | channel;
+                    off.msg[2] = 0;
+                    switchbox_write_targets(self, lane, *held & ~targets, (LV2_Atom_Event*)&off);
+                }
+
+                LV2_Atom_MIDI on;
+                memcpy(&on, ev, sizeof(LV2_Atom_MIDI));
+
+                for (uint32_t bits = targets; bits != 0; bits &= bits - 1)
+                {
+                    const int t = __builtin_ctz(bits);
+                    const int scaled = (int)(velocity * table->key_gain[note][t] * table->velocity_gain[velocity][t] + 0.5f);
+
+                    on.msg[2] = scaled > 1 ? scaled : 1;
+                    switchbox_write(self, switchbox_output_index(t, lane), (LV2_Atom_Event*)&on);
+                }
+
+                *held = targets;
+                break;
+            }
+            switchbox_write_targets(self, lane, *held, ev);
+            *held = 0;
+            break;
+
+        case 0x80:
+            switchbox_write_targets(self, lane, *held, ev);
+            *held = 0;
+            break;
+
+        case 0xA0:
+            switchbox_write_targets(self, lane, *held, ev);
+            break;
+
+        case 0xB0:
+            if (msg[1] == 0x78 || msg[1] == 0x7B)
+                memset(self->zone_notes[lane][channel], 0, sizeof(self->zone_notes[lane][channel]));
+            switchbox_write_targets(self, lane, all, ev);
+            break;
+
+        default:
+            switchbox_write_targets(self, lane, all, ev);
+            break;
+        }
+    }
+}
+#endif
+
+#if SWITCHBOX_INPUTS > 1
+// interleave the events of all unmuted inputs of `lane` into its output, in frame order
+static void switchbox_merge_lane(Data* const self, const uint32_t lane, const SwitchboxMerge* const merge)
+{
+    const LV2_Atom_Sequence* in[SWITCHBOX_INPUTS];
+    const LV2_Atom_Event* ev[SWITCHBOX_INPUTS];
+    const uint32_t o = switchbox_output_index(0, lane);
+
+    for (int t = 0; t < SWITCHBOX_INPUTS; ++t)
+    {
+        const uint32_t i = switchbox_input_index(t, lane);
+
+        in[t] = self->port_events_in[i];
+        ev[t] = lv2_atom_sequence_begin(&in[t]->body);
+
+        if (merge->mute[i] || lv2_atom_sequence_is_end(&in[t]->body, in[t]->atom.size, ev[t]))
+            ev[t] = NULL;
+    }
+
+    for (;;)
+    {
+        // earliest pending event, the first input wins ties
+        int next = -1;
+
+        for (int t = 0; t < SWITCHBOX_INPUTS; ++t)
+        {
+            if (ev[t] != NULL && (next < 0 || ev[t]->time.frames < ev[next]->time.frames))
+                next = t;
+        }
+
+        if (next < 0)
+            break;
+
+        const LV2_Atom_Event* const cur = ev[next];
+        const int channel = merge->channel[switchbox_input_index(next, lane)];
+
+        ev[next] = lv2_atom_sequence_next(cur);
+        if (lv2_atom_sequence_is_end(&in[next]->body, in[next]->atom.size, ev[next]))
+            ev[next] = NULL;
+
+        if (! switchbox_is_routed_event(self, in[next], cur))
+            continue;
+
+        const uint8_t* const msg = (const uint8_t*)(cur + 1);
+
+        if (channel >= 0 && cur->body.size <= 3 && msg[0] >= 0x80 && msg[0] < 0xF0)
+        {
+            LV2_Atom_MIDI remapped;
+            memcpy(&remapped, cur, sizeof(LV2_Atom_Event) + cur->body.size);
+            remapped.msg[0] = (msg[0] & 0xF0) | channel;
+            switchbox_write(self, o, (LV2_Atom_Event*)&remapped);
+        }
+        else
+        {
+            switchbox_write(self, o, cur);
+        }
+    }
+}
+#endif
+
+// route the events of `in` from frame `start` until `end` to output `o`
+static void switchbox_route_segment(Data* const self, const uint32_t lane, const bool sticky,
+                                    const LV2_Atom_Sequence* const in,
+                                    const int64_t start, const int64_t end, const uint32_t o)
+{
+    const LV2_Atom_Event* ev = start > 0 ? switchbox_seek(in, start) : lv2_atom_sequence_begin(&in->body);
+
+#if SWITCHBOX_OUTPUTS > 1
+    if (sticky)
+    {
+        switchbox_run_sticky(self, lane, in, ev, end, o);
+        return;
+    }
+#endif
+
+    const LV2_Atom_Sequence* const out = self->port_events_out[o];
+
+    // Copy everything at once if the whole input fits, and no older events are waiting
+    if (self->spill[o].count == 0 &&
+        self->out_capacity[o] - out->atom.size >= lv2_atom_pad_size(in->atom.size - sizeof(LV2_Atom_Sequence_Body)))
+    {
+        switchbox_copy_events(self, in, ev, end, o);
+        return;
+    }
+
+    // Read incoming events
+    for (; switchbox_in_segment(in, ev, end); ev = lv2_atom_sequence_next(ev))
+    {
+        if (switchbox_is_routed_event(self, in, ev))
+            switchbox_write(self, o, ev);
+    }
+}
+
+static LV2_Handle instantiate(const LV2_Descriptor*     descriptor,
+                              double                    rate,
+                              const char*               path,
+                              const LV2_Feature* const* features)
+{
+    Data* self = (Data*)calloc(1, sizeof(Data));
+
+    // Get host features
+    const LV2_URID_Map* map = NULL;
+
+    for (int i = 0; features[i]; ++i) {
+        if (!strcmp(features[i]->URI, LV2_URID__map)) {
+            map = (const LV2_URID_Map*)features[i]->data;
+            break;
+        }
+    }
+    if (!map) {
+        free(self);
+        return NULL;
+    }
+
+#ifdef MOD_RUN_STATS
+    self->stats = run_stats_new();
+
+    if (!self->stats) {
+        free(self);
+        return NULL;
+    }
+#endif
+
+    // Map URIs
+    self->urid_midiEvent = map->map(map->handle, LV2_MIDI__MidiEvent);
+
+    self->previous_target = 0;
+    self->previous_sticky = false;
+
+    return self;
+}
+
+static void connect_port(LV2_Handle instance, uint32_t port, void* data)
+{
+    Data* self = (Data*)instance;
+
+    if (port >= PORT_ATOM_IN1 && port < PORT_ATOM_OUT1)
+    {
+        self->port_events_in[port - PORT_ATOM_IN1] = (const LV2_Atom_Sequence*)data;
+        return;
+    }
+    if (port >= PORT_ATOM_OUT1 && port < PORT_ATOM_OUT1 + SWITCHBOX_NUM_OUTPUT_PORTS)
+    {
+        self->port_events_out[port - PORT_ATOM_OUT1] = (LV2_Atom_Sequence*)data;
+        return;
+    }
+
+    switch (port)
+    {
+    case PORT_CONTROL_TARGET:
+            self->port_target = (const float*)data;
+            break;
+#if SWITCHBOX_OUTPUTS > 1
+    case PORT_CONTROL_STICKY:
+            self->port_sticky = (const float*)data;
+            break;
+#endif
+    case PORT_CONTROL_SWITCH_MODE:
+            self->port_switch_mode = (const float*)data;
+            break;
+    case PORT_CONTROL_SWITCH_CHANNEL:
+            self->port_switch_channel = (const float*)data;
+            break;
+    case PORT_CONTROL_SWITCH_CC:
+            self->port_switch_cc = (const float*)data;
+            break;
+    case PORT_CONTROL_DROPPED:
+            self->port_dropped = (float*)data;
+            break;
+    case PORT_CONTROL_DEFERRED:
+            self->port_deferred = (float*)data;
+            break;
+#if SWITCHBOX_OUTPUTS > 1
+    case PORT_CONTROL_CHANNEL_ROUTING:
+            self->port_channel_routing = (const float*)data;
+            break;
+    case PORT_CONTROL_ZONES:
+            self->port_zones = (const float*)data;
+            break;
+    case PORT_CONTROL_ZONE_KEY_OVERLAP:
+            self->port_zone_key_overlap = (const float*)data;
+            break;
+    case PORT_CONTROL_ZONE_VELOCITY_OVERLAP:
+            self->port_zone_velocity_overlap = (const float*)data;
+            break;
+    default:
+        if (port >= PORT_CONTROL_CH1_OUTPUT && port < PORT_CONTROL_ZONES)
+        {
+            self->port_channel_output[port - PORT_CONTROL_CH1_OUTPUT] = (const float*)data;
+        }
+        else if (port >= PORT_CONTROL_ZONE1_KEY_LOW && port < PORT_COUNT)
+        {
+            const uint32_t t = (port - PORT_CONTROL_ZONE1_KEY_LOW) / 4;
+
+            switch ((port - PORT_CONTROL_ZONE1_KEY_LOW) % 4)
+            {
+            case 0:
+                self->port_zone_key_low[t] = (const float*)data;
+                break;
+            case 1:
+                self->port_zone_key_high[t] = (const float*)data;
+                break;
+            case 2:
+                self->port_zone_velocity_low[t] = (const float*)data;
+                break;
+            case 3:
+                self->port_zone_velocity_high[t] = (const float*)data;
+                break;
+            }
+        }
+        break;
+#endif
+#if SWITCHBOX_INPUTS > 1
+    case PORT_CONTROL_MERGE:
+            self->port_merge = (const float*)data;
+            break;
+    default:
+        if (port >= PORT_CONTROL_IN1_CHANNEL && port < PORT_CONTROL_DROPPED)
+        {
+            const uint32_t i = (port - PORT_CONTROL_IN1_CHANNEL) / 2;
+
+            if ((port - PORT_CONTROL_IN1_CHANNEL) % 2 == 0)
+                self->port_merge_channel[i] = (const float*)data;
+            else
+                self->port_merge_mute[i] = (const float*)data;
+        }
+        break;
+#endif
+    }
+}
+
+static void activate(LV2_Handle instance)
+{
+    Data* self = (Data*)instance;
+
+    for (uint32_t o = 0; o < SWITCHBOX_NUM_OUTPUT_PORTS; ++o)
+    {
+        note_tracker_reset(&self->notes[o]);
+        spill_queue_reset(&self->spill[o]);
+    }
+
+#if SWITCHBOX_OUTPUTS > 1
+    memset(self->note_owner, 0, sizeof(self->note_owner));
+    memset(self->zone_notes, 0, sizeof(self->zone_notes));
+#endif
+    self->previous_sticky = false;
+    memset(&self->previous_merge, 0, sizeof(self->previous_merge));
+    memset(&self->previous_channel_routing, 0, sizeof(self->previous_channel_routing));
+    memset(&self->previous_zones, 0, sizeof(self->previous_zones));
+}
+
+static void run(LV2_Handle instance, uint32_t sample_count)
+{
+    Data* self = (Data*)instance;
+
+#ifdef MOD_RUN_STATS
+    const uint64_t run_start = run_stats_ticks();
+#endif
+
+    SwitchboxChannelRouting routing;
+    memset(&routing, 0, sizeof(routing));
+
+    SwitchboxZones zones;
+    memset(&zones, 0, sizeof(zones));
+
+#if SWITCHBOX_OUTPUTS > 1
+    routing.enabled = *self->port_channel_routing > 0.5f;
+
+    for (uint8_t c = 0; c < 16; ++c)
+    {
+        const int output = (int)(*self->port_channel_output[c] + 0.5f) - 1;
+
+        routing.output[c] = output < SWITCHBOX_OUTPUTS ? output : SWITCHBOX_OUTPUTS - 1;
+    }
+
+    // Channel routing takes precedence over zones
+    zones.enabled = *self->port_zones > 0.5f && ! routing.enabled;
+
+    if (zones.enabled)
+    {
+        zones.key_overlap      = (int)(*self->port_zone_key_overlap + 0.5f);
+        zones.velocity_overlap = (int)(*self->port_zone_velocity_overlap + 0.5f);
+
+        for (uint32_t t = 0; t < SWITCHBOX_OUTPUTS; ++t)
+        {
+            zones.key_low[t]       = (int)(*self->port_zone_key_low[t] + 0.5f);
+            zones.key_high[t]      = (int)(*self->port_zone_key_high[t] + 0.5f);
+            zones.velocity_low[t]  = (int)(*self->port_zone_velocity_low[t] + 0.5f);
+            zones.velocity_high[t] = (int)(*self->port_zone_velocity_high[t] + 0.5f);
+        }
+    }
+
+    // Notes always follow their channel or note-on when routing by channel or zones
+    const bool sticky = *self->port_sticky > 0.5f && ! routing.enabled && ! zones.enabled;
+#else
+    const bool sticky = false;
+#endif
+
+    self->switch_mode    = (SwitchModeEnum)(int)(*self->port_switch_mode + 0.5f);
+    self->switch_channel = (int)(*self->port_switch_channel + 0.5f) - 1;
+    self->switch_cc      = (int)(*self->port_switch_cc + 0.5f);
+
+    SwitchboxMerge merge;
+    memset(&merge, 0, sizeof(merge));
+
+#if SWITCHBOX_INPUTS > 1
+    merge.enabled = *self->port_merge > 0.5f;
+
+    for (uint32_t i = 0; i < SWITCHBOX_NUM_INPUT_PORTS; ++i)
+    {
+        merge.channel[i] = (int)(*self->port_merge_channel[i] + 0.5f) - 1;
+        merge.mute[i]    = *self->port_merge_mute[i] > 0.5f;
+    }
+#endif
+
+    // The target control is only used when not switching in-band
+    const int target = self->switch_mode == SWITCH_MODE_CONTROL
+                     ? switchbox_target_from_control(*self->port_target)
+                     : self->previous_target;
+
+    for (uint32_t o = 0; o < SWITCHBOX_NUM_OUTPUT_PORTS; ++o)
+    {
+        LV2_Atom_Sequence* const out = self->port_events_out[o];
+
+        // Get the capacity
+        self->out_capacity[o] = out->atom.size;
+
+        // Write an empty Sequence header to the output
+        lv2_atom_sequence_clear(out);
+
+        // LV2 is so nice...
+        out->atom.type = self->port_events_in[o % SWITCHBOX_LANES]->atom.type;
+
+        // Send what did not fit last time first
+        spill_queue_flush(&self->spill[o], out, self->out_capacity[o]);
+    }
+
+    // Send note-offs to the outputs no longer in use if target changed.
+    // In sticky mode notes are left to end on their own, until sticky mode is turned off.
+    // When merging or routing by channel the target is not used, but changing those settings also needs a release.
+    // Switching between channel routing, zones and sticky mode keeps notes where they are, the new mode takes them over.
+    if ((self->previous_target != target && ! sticky && ! merge.enabled && ! routing.enabled && ! zones.enabled) ||
+        (self->previous_sticky && ! sticky && ! routing.enabled && ! zones.enabled) ||
+        (self->previous_channel_routing.enabled && ! routing.enabled && ! zones.enabled && ! sticky) ||
+        (self->previous_zones.enabled && ! zones.enabled && ! routing.enabled && ! sticky) ||
+        switchbox_merge_changed(&merge, &self->previous_merge))
+    {
+        for (uint32_t l = 0; l < SWITCHBOX_LANES; ++l)
+            switchbox_release_lane(self, l, target, 0);
+    }
+
+#if SWITCHBOX_OUTPUTS > 1
+    // Only the channels that moved to another output are released
+    if (routing.enabled && switchbox_channel_routing_changed(&routing, &self->previous_channel_routing))
+    {
+        for (uint32_t l = 0; l < SWITCHBOX_LANES; ++l)
+            switchbox_release_moved_channels(self, l, &routing);
+    }
+#endif
+
+#if SWITCHBOX_OUTPUTS > 1
+    if (sticky && ! self->previous_sticky)
+        switchbox_claim_notes(self);
+
+    if (zones.enabled && ! self->previous_zones.enabled)
+        switchbox_claim_zone_notes(self);
+
+    if (switchbox_zones_changed(&zones, &self->previous_zones) && zones.enabled)
+        switchbox_compile_zones(self, &zones);
+#endif
+
+    self->previous_sticky = sticky;
+    self->previous_merge = merge;
+    self->previous_channel_routing = routing;
+    self->previous_zones = zones;
+
+    switchbox_collect_switches(self, target);
+
+    // Route each lane, the ports involved are fixed until the next in-band switch
+    for (uint32_t l = 0; l < SWITCHBOX_LANES; ++l)
+    {
+#if SWITCHBOX_INPUTS > 1
+        if (merge.enabled)
+        {
+            switchbox_merge_lane(self, l, &merge);
+            continue;
+        }
+#endif
+#if SWITCHBOX_OUTPUTS > 1
+        if (routing.enabled)
+        {
+            switchbox_route_channels(self, l, &routing);
+            continue;
+        }
+        if (zones.enabled)
+        {
+            switchbox_route_zones(self, l);
+            continue;
+        }
+#endif
+
+        int segment_target = target;
+        int64_t start = 0;
+
+        for (uint32_t i = 0;; ++i)
+        {
+            const int64_t end = i < self->num_switches ? self->switches[i].frame : INT64_MAX;
+
+            switchbox_route_segment(self, l, sticky,
+                                    self->port_events_in[switchbox_input_index(segment_target, l)],
+                                    start, end,
+                                    switchbox_output_index(segment_target, l));
+
+            if (i == self->num_switches)
+                break;
+
+            segment_target = self->switches[i].target;
+            start = end;
+
+            if (! sticky)
+                switchbox_release_lane(self, l, segment_target, end);
+        }
+    }
+
+    self->previous_target = self->num_switches != 0
+                          ? self->switches[self->num_switches - 1].target
+                          : target;
+
+    uint32_t dropped = 0, deferred = 0;
+
+    for (uint32_t o = 0; o < SWITCHBOX_NUM_OUTPUT_PORTS; ++o)
+    {
+        dropped  += self->spill[o].dropped;
+        deferred += self->spill[o].deferred;
+    }
+
+    *self->port_dropped  = dropped;
+    *self->port_deferred = deferred;
+
+#ifdef MOD_RUN_STATS
+    uint32_t events = 0;
+
+    for (uint32_t i = 0; i < SWITCHBOX_NUM_INPUT_PORTS; ++i)
+    {
+        LV2_ATOM_SEQUENCE_FOREACH(self->port_events_in[i], ev)
+            ++events;
+    }
+
+    run_stats_end(self->stats, run_start, sample_count, events);
+#endif
+}
+
+static void cleanup(LV2_Handle instance)
+{
+#ifdef MOD_RUN_STATS
+    run_stats_free(((Data*)instance)->stats);
+#endif
+    free(instance);
+}
+
+#ifdef MOD_RUN_STATS
+static bool snapshot_run_stats(LV2_Handle instance, RunStats* stats)
+{
+    return run_stats_snapshot(((Data*)instance)->stats, stats);
+}
+#endif
+
+static const void* extension_data(const char* uri)
+{
+#ifdef MOD_RUN_STATS
+    static const MOD_Run_Stats_Interface run_stats = { snapshot_run_stats };
+
+    if (!strcmp(uri, MOD_RUN_STATS__interface))
+        return &run_stats;
+#endif
+
+    return NULL;
+}
+
+static const LV2_Descriptor descriptor = {
+    .URI = SWITCHBOX_URI,
+    .instantiate = instantiate,
+    .connect_port = connect_port,
+    .activate = activate,
+    .run = run,
+    .deactivate = NULL,
+    .cleanup = cleanup,
+    .extension_data = extension_data
+};
+
+#ifdef MOD_BUNDLE_DESCRIPTOR
+// built as part of the combined bundle, see mod-midi-utilities.lv2
+__attribute__((visibility("hidden")))
+const LV2_Descriptor* MOD_BUNDLE_DESCRIPTOR(void)
+{
+    return &descriptor;
+}
+#else
+LV2_SYMBOL_EXPORT
+const LV2_Descriptor* lv2_descriptor(uint32_t index)
+{
+    return (index == 0) ? &descriptor : NULL;
+}
+#endif
+
+#endif // SWITCHBOX_H_INCLUDED
@@ -0,0 +1,128 @@
+/*
+ * Host-free benchmark, runs each given plugin bundle with generated traffic
+ * over a range of block sizes and event densities, and reports the time spent in run().
+ *
+ * Plugins built with MOD_RUN_STATS also have their own run() statistics printed after their results.
+ *
+ * Usage: bench <bundle.lv2>...
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "host.h"
+#include "../common/runstats.h"
+
+#include <time.h>
+
+static const uint32_t kBlockSizes[] = { 16, 64, 256, 1024, 4096 };
+static const uint32_t kDensities[]  = { 0, 1, 10, 100, 1000 };
+
+// total frames processed for each block size and density, so all combinations take about as long
+#define BENCH_FRAMES (1 << 20)
+#define BENCH_WARMUP_RUNS 16
+
+static inline int64_t bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// print the run() cost recorded by the plugin itself, if built with MOD_RUN_STATS
+static void bench_print_run_stats(HarnessPlugin* const plugin)
+{
+    const MOD_Run_Stats_Interface* const iface = plugin->descriptor->extension_data != NULL
+        ? (const MOD_Run_Stats_Interface*)plugin->descriptor->extension_data(MOD_RUN_STATS__interface)
+        : NULL;
+
+    RunStats stats;
+
+    if (iface == NULL || ! iface->snapshot(plugin->handle, &stats) || stats.runs == 0)
+        return;
+
+    printf("%-24s run stats: %u runs, %llu events, p50 < %llu ticks, p99 < %llu ticks, max %llu ticks\n",
+           plugin->name, stats.runs, (unsigned long long)stats.events,
+           (unsigned long long)run_stats_percentile(&stats, 0.5),
+           (unsigned long long)run_stats_percentile(&stats, 0.99),
+           (unsigned long long)stats.max_ticks);
+}
+
+static void bench_plugin(HarnessPlugin* const plugin)
+{
+    const LV2_Descriptor* const descriptor = plugin->descriptor;
+
+    for (uint32_t b = 0; b < sizeof(kBlockSizes) / sizeof(kBlockSizes[0]); ++b)
+    {
+        const uint32_t block_size = kBlockSizes[b];
+        const uint32_t runs = BENCH_FRAMES / block_size;
+
+        for (uint32_t d = 0; d < sizeof(kDensities) / sizeof(kDensities[0]); ++d)
+        {
+            const uint32_t density = kDensities[d];
+            int64_t total = 0, worst = 0;
+
+            harness_fill_inputs(plugin, block_size, density);
+
+            for (uint32_t i = 0; i < BENCH_WARMUP_RUNS; ++i)
+            {
+                harness_reset_outputs(plugin);
+                descriptor->run(plugin->handle, block_size);
+                harness_do_work(plugin);
+            }
+
+            for (uint32_t i = 0; i < runs; ++i)
+            {
+                harness_reset_outputs(plugin);
+
+                const int64_t start = bench_now();
+                descriptor->run(plugin->handle, block_size);
+                const int64_t elapsed = bench_now() - start;
+
+                harness_do_work(plugin);
+
+                total += elapsed;
+                if (elapsed > worst)
+                    worst = elapsed;
+            }
+
+            const double ns_per_block = (double)total / runs;
+
+            if (density != 0)
+                printf("%-24s %6u %7u %12.1f %10.2f %10lld\n",
+                       plugin->name, block_size, density, ns_per_block, ns_per_block / density, (long long)worst);
+            else
+                printf("%-24s %6u %7u %12.1f %10s %10lld\n",
+                       plugin->name, block_size, density, ns_per_block, "-", (long long)worst);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <bundle.lv2>...\n", argv[0]);
+        return 1;
+    }
+
+    int ret = 0;
+
+    printf("%-24s %6s %7s %12s %10s %10s\n", "plugin", "block", "events", "ns/block", "ns/event", "worst ns");
+
+    for (int i = 1; i < argc; ++i)
+    {
+        HarnessPlugin plugin;
+
+        if (! harness_load(&plugin, argv[i]))
+        {
+            ret = 1;
+            continue;
+        }
+
+        bench_plugin(&plugin);
+        bench_print_run_stats(&plugin);
+        harness_unload(&plugin);
+    }
+
+    return ret;
+}
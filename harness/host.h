@@ -0,0 +1,497 @@
+/*
+ * Minimal plugin host for the harness tools.
+ *
+ * Loads a single plugin bundle directly, without a real LV2 host.
+ * The only features given are a stub URID map, a log that discards everything, a worker schedule,
+ * and options with the nominal and maximum block lengths.
+ * Scheduled work is done by harness_do_work(), outside of run().
+ * Ports are read from the bundle TTL, each one gets a buffer owned by the host and control inputs
+ * are set to their default value.
+ * Input atom ports are filled with generated MIDI traffic and audio inputs with a test signal.
+ */
+
+#ifndef HARNESS_HOST_H_INCLUDED
+#define HARNESS_HOST_H_INCLUDED
+
+#include <lv2/lv2plug.in/ns/lv2core/lv2.h>
+#include <lv2/lv2plug.in/ns/ext/atom/util.h>
+#include <lv2/lv2plug.in/ns/ext/buf-size/buf-size.h>
+#include <lv2/lv2plug.in/ns/ext/midi/midi.h>
+#include <lv2/lv2plug.in/ns/ext/options/options.h>
+#include <lv2/lv2plug.in/ns/ext/urid/urid.h>
+#include <lv2/lv2plug.in/ns/ext/log/log.h>
+#include <lv2/lv2plug.in/ns/ext/worker/worker.h>
+
+#include <dlfcn.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HARNESS_MAX_PORTS       64
+#define HARNESS_MAX_URIDS       256
+#define HARNESS_MAX_BLOCK_SIZE  4096
+#define HARNESS_NOMINAL_BLOCK_SIZE 128
+#define HARNESS_ATOM_CAPACITY   (128 * 1024)
+#define HARNESS_SAMPLE_RATE     48000.0
+
+typedef enum {
+    HARNESS_PORT_CONTROL = 0,
+    HARNESS_PORT_AUDIO,
+    HARNESS_PORT_ATOM
+} HarnessPortType;
+
+typedef struct {
+    HarnessPortType type;
+    bool input;
+    float control;
+    float default_value, minimum, maximum;
+    float* audio;
+    LV2_Atom_Sequence* atom;
+} HarnessPort;
+
+typedef struct {
+    char name[128];
+    void* lib;
+    const LV2_Descriptor* descriptor;
+    LV2_Handle handle;
+    uint32_t num_ports;
+    HarnessPort ports[HARNESS_MAX_PORTS];
+
+    // worker
+    const LV2_Worker_Interface* worker;
+    LV2_Worker_Schedule schedule;
+    LV2_Feature schedule_feature;
+    bool work_pending;
+
+    // options
+    LV2_Options_Option options[3];
+    LV2_Feature options_feature;
+
+    const LV2_Feature* features[5];
+} HarnessPlugin;
+
+// --------------------------------------------------------------------------------------------------------------------
+// URID map
+
+static char* harness_uris[HARNESS_MAX_URIDS];
+static uint32_t harness_num_uris = 0;
+
+static LV2_URID harness_map_uri(LV2_URID_Map_Handle handle, const char* const uri)
+{
+    for (uint32_t i = 0; i < harness_num_uris; ++i)
+    {
+        if (!strcmp(harness_uris[i], uri))
+            return i + 1;
+    }
+
+    if (harness_num_uris == HARNESS_MAX_URIDS)
+        return 0;
+
+    harness_uris[harness_num_uris] = strdup(uri);
+    return ++harness_num_uris;
+}
+
+static LV2_URID_Map harness_map = { NULL, harness_map_uri };
+static const LV2_Feature harness_map_feature = { LV2_URID__map, &harness_map };
+
+// --------------------------------------------------------------------------------------------------------------------
+// Log, messages are discarded so they do not get in the way of the harness output
+
+static int harness_log_vprintf(LV2_Log_Handle handle, LV2_URID type, const char* fmt, va_list ap)
+{
+    return 0;
+}
+
+static int harness_log_printf(LV2_Log_Handle handle, LV2_URID type, const char* fmt, ...)
+{
+    return 0;
+}
+
+static LV2_Log_Log harness_log = { NULL, harness_log_printf, harness_log_vprintf };
+static const LV2_Feature harness_log_feature = { LV2_LOG__log, &harness_log };
+
+// --------------------------------------------------------------------------------------------------------------------
+// Options, the block lengths the harness runs plugins with
+
+static const int32_t harness_max_block_length = HARNESS_MAX_BLOCK_SIZE;
+static const int32_t harness_nominal_block_length = HARNESS_NOMINAL_BLOCK_SIZE;
+
+static void harness_set_options(HarnessPlugin* const plugin)
+{
+    const LV2_URID urid_atomInt = harness_map_uri(NULL, LV2_ATOM__Int);
+
+    const LV2_Options_Option options[3] = {
+        { LV2_OPTIONS_INSTANCE, 0, harness_map_uri(NULL, LV2_BUF_SIZE__maxBlockLength),
+          sizeof(int32_t), urid_atomInt, &harness_max_block_length },
+        { LV2_OPTIONS_INSTANCE, 0, harness_map_uri(NULL, LV2_BUF_SIZE__nominalBlockLength),
+          sizeof(int32_t), urid_atomInt, &harness_nominal_block_length },
+        { LV2_OPTIONS_INSTANCE, 0, 0, 0, 0, NULL }
+    };
+
+    memcpy(plugin->options, options, sizeof(options));
+
+    plugin->options_feature.URI = LV2_OPTIONS__options;
+    plugin->options_feature.data = plugin->options;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Worker, requests are only flagged here and handled by harness_do_work
+
+static LV2_Worker_Status harness_schedule_work(LV2_Worker_Schedule_Handle handle, uint32_t size, const void* data)
+{
+    ((HarnessPlugin*)handle)->work_pending = true;
+    return LV2_WORKER_SUCCESS;
+}
+
+static LV2_Worker_Status harness_work_respond(LV2_Worker_Respond_Handle handle, uint32_t size, const void* data)
+{
+    return LV2_WORKER_SUCCESS;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// TTL port list, only understands the layout used by the plugins in this repository
+
+static char* harness_read_file(const char* const filename)
+{
+    FILE* const file = fopen(filename, "rb");
+
+    if (file == NULL)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* const data = (char*)malloc(size + 1);
+
+    if (fread(data, 1, size, file) != (size_t)size)
+    {
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+
+    data[size] = '\0';
+    fclose(file);
+    return data;
+}
+
+// next port definition in `ttl`, or NULL if there are no more
+static const char* harness_next_port(const char* const ttl)
+{
+    const char* const in  = strstr(ttl, "a lv2:InputPort");
+    const char* const out = strstr(ttl, "a lv2:OutputPort");
+
+    if (in == NULL)
+        return out;
+    if (out == NULL)
+        return in;
+    return in < out ? in : out;
+}
+
+// whether `needle` is found in `port` before `end` (or the end of the string if NULL)
+static bool harness_port_has(const char* const port, const char* const end, const char* const needle)
+{
+    const char* const found = strstr(port, needle);
+
+    return found != NULL && (end == NULL || found < end);
+}
+
+// value of the `property` of `port`, or `fallback` if it has none
+static float harness_port_value(const char* const port, const char* const end,
+                                const char* const property, const float fallback)
+{
+    const char* const found = strstr(port, property);
+
+    return found != NULL && (end == NULL || found < end) ? (float)atof(found + strlen(property)) : fallback;
+}
+
+static bool harness_read_ports(HarnessPlugin* const plugin, const char* const filename)
+{
+    char* const ttl = harness_read_file(filename);
+
+    if (ttl == NULL)
+    {
+        fprintf(stderr, "%s: cannot read %s\n", plugin->name, filename);
+        return false;
+    }
+
+    plugin->num_ports = 0;
+
+    for (const char* port = harness_next_port(ttl); port != NULL;)
+    {
+        const char* const end = harness_next_port(port + 1);
+        const char* const index_str = strstr(port, "lv2:index ");
+        const int index = index_str != NULL ? atoi(index_str + 10) : -1;
+
+        if (index < 0 || index >= HARNESS_MAX_PORTS || (end != NULL && index_str > end))
+        {
+            fprintf(stderr, "%s: invalid port index in %s\n", plugin->name, filename);
+            free(ttl);
+            return false;
+        }
+
+        HarnessPort* const p = &plugin->ports[index];
+
+        p->input = strncmp(port, "a lv2:InputPort", 15) == 0;
+
+        if (harness_port_has(port, end, "lv2:AudioPort"))
+            p->type = HARNESS_PORT_AUDIO;
+        else if (harness_port_has(port, end, "atom:AtomPort"))
+            p->type = HARNESS_PORT_ATOM;
+        else
+            p->type = HARNESS_PORT_CONTROL;
+
+        p->default_value = harness_port_value(port, end, "lv2:default ", 0.0f);
+        p->minimum = harness_port_value(port, end, "lv2:minimum ", p->default_value);
+        p->maximum = harness_port_value(port, end, "lv2:maximum ", p->default_value);
+        p->control = p->default_value;
+
+        if ((uint32_t)index >= plugin->num_ports)
+            plugin->num_ports = index + 1;
+
+        port = end;
+    }
+
+    free(ttl);
+    return true;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Plugin loading
+
+static void harness_unload(HarnessPlugin* const plugin)
+{
+    if (plugin->handle != NULL)
+        plugin->descriptor->cleanup(plugin->handle);
+
+    for (uint32_t i = 0; i < plugin->num_ports; ++i)
+    {
+        free(plugin->ports[i].audio);
+        free(plugin->ports[i].atom);
+    }
+
+    if (plugin->lib != NULL)
+        dlclose(plugin->lib);
+
+    memset(plugin, 0, sizeof(HarnessPlugin));
+}
+
+// load and instantiate the plugin in `bundle`, a directory named after the plugin with a .lv2 suffix
+static bool harness_load(HarnessPlugin* const plugin, const char* const bundle)
+{
+    memset(plugin, 0, sizeof(HarnessPlugin));
+
+    const char* const basename = strrchr(bundle, '/') != NULL ? strrchr(bundle, '/') + 1 : bundle;
+    const size_t len = strlen(basename);
+
+    if (len <= 4 || len >= sizeof(plugin->name) || strcmp(basename + len - 4, ".lv2") != 0)
+    {
+        fprintf(stderr, "%s: not a plugin bundle\n", bundle);
+        return false;
+    }
+
+    memcpy(plugin->name, basename, len - 4);
+
+    char filename[1024];
+
+    snprintf(filename, sizeof(filename), "%s/%s.ttl", bundle, plugin->name);
+    if (! harness_read_ports(plugin, filename))
+        return false;
+
+    snprintf(filename, sizeof(filename), "%s/%s.so", bundle, plugin->name);
+    plugin->lib = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+
+    if (plugin->lib == NULL)
+    {
+        fprintf(stderr, "%s: %s\n", plugin->name, dlerror());
+        harness_unload(plugin);
+        return false;
+    }
+
+    const LV2_Descriptor_Function descriptor_function = (LV2_Descriptor_Function)dlsym(plugin->lib, "lv2_descriptor");
+
+    if (descriptor_function == NULL || (plugin->descriptor = descriptor_function(0)) == NULL)
+    {
+        fprintf(stderr, "%s: no plugin descriptor\n", plugin->name);
+        harness_unload(plugin);
+        return false;
+    }
+
+    plugin->schedule.handle = plugin;
+    plugin->schedule.schedule_work = harness_schedule_work;
+    plugin->schedule_feature.URI = LV2_WORKER__schedule;
+    plugin->schedule_feature.data = &plugin->schedule;
+
+    harness_set_options(plugin);
+
+    plugin->features[0] = &harness_map_feature;
+    plugin->features[1] = &harness_log_feature;
+    plugin->features[2] = &plugin->schedule_feature;
+    plugin->features[3] = &plugin->options_feature;
+    plugin->features[4] = NULL;
+
+    plugin->handle = plugin->descriptor->instantiate(plugin->descriptor, HARNESS_SAMPLE_RATE, bundle, plugin->features);
+
+    if (plugin->handle == NULL)
+    {
+        fprintf(stderr, "%s: instantiate failed\n", plugin->name);
+        harness_unload(plugin);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < plugin->num_ports; ++i)
+    {
+        HarnessPort* const p = &plugin->ports[i];
+
+        switch (p->type)
+        {
+        case HARNESS_PORT_CONTROL:
+            plugin->descriptor->connect_port(plugin->handle, i, &p->control);
+            break;
+
+        case HARNESS_PORT_AUDIO:
+            p->audio = (float*)calloc(HARNESS_MAX_BLOCK_SIZE, sizeof(float));
+
+            // a 440Hz sine, with its level slowly going up and down between blocks
+            if (p->input)
+                for (uint32_t s = 0; s < HARNESS_MAX_BLOCK_SIZE; ++s)
+                    p->audio[s] = sinf(2.0f * 3.14159265f * 440.0f * s / HARNESS_SAMPLE_RATE)
+                                * (0.5f + 0.5f * sinf(s * 0.001f));
+
+            plugin->descriptor->connect_port(plugin->handle, i, p->audio);
+            break;
+
+        case HARNESS_PORT_ATOM:
+            p->atom = (LV2_Atom_Sequence*)calloc(1, HARNESS_ATOM_CAPACITY);
+            p->atom->atom.size = sizeof(LV2_Atom_Sequence_Body);
+            p->atom->atom.type = harness_map_uri(NULL, LV2_ATOM__Sequence);
+            plugin->descriptor->connect_port(plugin->handle, i, p->atom);
+            break;
+        }
+    }
+
+    if (plugin->descriptor->extension_data != NULL)
+        plugin->worker = (const LV2_Worker_Interface*)plugin->descriptor->extension_data(LV2_WORKER__interface);
+
+    if (plugin->descriptor->activate != NULL)
+        plugin->descriptor->activate(plugin->handle);
+
+    return true;
+}
+
+// do the work scheduled during the last run, as the host worker thread would
+static void harness_do_work(HarnessPlugin* const plugin)
+{
+    if (! plugin->work_pending || plugin->worker == NULL)
+        return;
+
+    plugin->work_pending = false;
+    plugin->worker->work(plugin->handle, harness_work_respond, NULL, 0, NULL);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Traffic
+
+// Struct for a 3 byte MIDI event
+typedef struct {
+    LV2_Atom_Event event;
+    uint8_t        msg[3];
+} HarnessMidiEvent;
+
+// key of the note started by event `i`
+static inline uint8_t harness_note(const uint32_t i)
+{
+    return 36 + (i * 7) % 48;
+}
+
+// fill all input atom ports with `density` MIDI events spread evenly over `block_size` frames.
+// the traffic cycles through notes, controllers, pitch bend, clock, time code, song position and transport messages.
+static void harness_fill_inputs(HarnessPlugin* const plugin, const uint32_t block_size, const uint32_t density)
+{
+    const LV2_URID urid_midiEvent = harness_map_uri(NULL, LV2_MIDI__MidiEvent);
+
+    for (uint32_t p = 0; p < plugin->num_ports; ++p)
+    {
+        LV2_Atom_Sequence* const seq = plugin->ports[p].atom;
+
+        if (seq == NULL || ! plugin->ports[p].input)
+            continue;
+
+        lv2_atom_sequence_clear(seq);
+
+        for (uint32_t i = 0; i < density; ++i)
+        {
+            HarnessMidiEvent ev;
+            memset(&ev, 0, sizeof(ev));
+
+            ev.event.time.frames = (int64_t)i * block_size / density;
+            ev.event.body.type = urid_midiEvent;
+            ev.event.body.size = 3;
+
+            const uint8_t channel = i % 4;
+
+            switch (i % 8)
+            {
+            case 0:
+                ev.msg[0] = 0x90 | channel;
+                ev.msg[1] = harness_note(i);
+                ev.msg[2] = 1 + (i * 13) % 127;
+                break;
+            case 1:
+                ev.msg[0] = 0xB0 | channel;
+                ev.msg[1] = 1;
+                ev.msg[2] = i % 128;
+                break;
+            case 2:
+                ev.msg[0] = 0x80 | ((i - 2) % 4);
+                ev.msg[1] = harness_note(i - 2);
+                break;
+            case 3:
+                ev.msg[0] = 0xF8;
+                ev.event.body.size = 1;
+                break;
+            case 4:
+                ev.msg[0] = 0xF1;
+                ev.msg[1] = (((i / 8) % 8) << 4) | (i % 16);
+                ev.event.body.size = 2;
+                break;
+            case 5:
+                ev.msg[0] = 0xE0 | channel;
+                ev.msg[1] = i % 128;
+                ev.msg[2] = 64;
+                break;
+            case 6:
+                ev.msg[0] = 0xF2;
+                ev.msg[1] = i % 128;
+                ev.msg[2] = (i / 128) % 128;
+                break;
+            case 7:
+                ev.msg[0] = (i / 8) % 2 ? 0xFC : 0xFA;
+                ev.event.body.size = 1;
+                break;
+            }
+
+            lv2_atom_sequence_append_event(seq, HARNESS_ATOM_CAPACITY, &ev.event);
+        }
+    }
+}
+
+// give all output atom ports their full capacity back, as a host does before each run
+static void harness_reset_outputs(HarnessPlugin* const plugin)
+{
+    for (uint32_t p = 0; p < plugin->num_ports; ++p)
+    {
+        LV2_Atom_Sequence* const seq = plugin->ports[p].atom;
+
+        if (seq == NULL || plugin->ports[p].input)
+            continue;
+
+        seq->atom.size = HARNESS_ATOM_CAPACITY - sizeof(LV2_Atom);
+        seq->atom.type = 0;
+    }
+}
+
+#endif // HARNESS_HOST_H_INCLUDED
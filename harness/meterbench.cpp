@@ -0,0 +1,226 @@
+/*
+ * Microbenchmark of the peak-to-cc meter kernels.
+ *
+ * Runs every kernel supported by this build and CPU over the same test signal, for each detector,
+ * with block sizes from 32 to 2048 frames, and reports the time per block and per frame,
+ * the speedup over the scalar kernel with the RMS detector, and the largest difference of the meter output
+ * from the scalar kernel with the same detector.
+ *
+ * Then runs every multichannel meter kernel for 2, 4 and 8 channels, see common/multimeter.h, against as many
+ * separate Kmeterdsp meters using the kernel for the same instruction set, and reports the time per channel and frame
+ * of both, the speedup over the separate meters with the same detector, and the largest difference of any channel
+ * level from separate scalar meters.
+ *
+ * Usage: meterbench
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../peak-to-cc.lv2/peakmeter/kmeterdsp.cc"
+#include "../common/multimeter.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const int kBlockSizes[] = { 32, 64, 128, 256, 512, 1024, 2048 };
+static const uint32_t kChannels[] = { 2, 4, 8 };
+
+// total frames processed for each kernel and block size
+#define METERBENCH_FRAMES (1 << 22)
+#define METERBENCH_SAMPLE_RATE 48000
+
+// block size of the multichannel runs, and the distance between the parts of the test signal each channel reads
+#define METERBENCH_MULTI_BLOCK 256
+#define METERBENCH_MULTI_SPREAD 3001
+
+static inline int64_t meterbench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// decaying tone bursts over a DC offset, with some clipping, so all parts of the meter are used
+static void meterbench_fill(float* const buffer, const int frames)
+{
+    uint32_t seed = 1;
+
+    for (int i = 0; i < frames; ++i)
+    {
+        const int pos = i % 24000;
+
+        seed = seed * 1664525 + 1013904223;
+
+        buffer[i] = 0.1f
+                  + 1.2f * expf(-pos / 4000.0f) * sinf(i * 0.0571f)
+                  + 0.01f * ((int32_t)seed / 2147483648.0f);
+    }
+}
+
+// time `kernel` with blocks of `block_size`, also comparing its output with the scalar kernel
+static double meterbench_kernel(const float* const buffer, const int kernel, const int detector,
+                                const int block_size, float* const error)
+{
+    Kmeterdsp meter, reference;
+
+    meter.select_kernel(kernel);
+    reference.select_kernel(Kmeterdsp::KERNEL_SCALAR);
+
+    meter.set_detector(detector);
+    reference.set_detector(detector);
+
+    meter.init(METERBENCH_SAMPLE_RATE, block_size, 0.25f, 30.0f);
+    reference.init(METERBENCH_SAMPLE_RATE, block_size, 0.25f, 30.0f);
+
+    int64_t total = 0;
+    *error = 0.0f;
+
+    for (int i = 0; i + block_size <= METERBENCH_FRAMES; i += block_size)
+    {
+        const int64_t start = meterbench_now();
+        const float peak = meter.process(buffer + i, block_size);
+        total += meterbench_now() - start;
+
+        const float diff = fabsf(peak - reference.process(buffer + i, block_size));
+
+        if (diff > *error)
+            *error = diff;
+    }
+
+    return (double)total / (METERBENCH_FRAMES / block_size);
+}
+
+// time `channels` separate meters and the multichannel meter, both with `kernel`, over blocks of
+// METERBENCH_MULTI_BLOCK, also comparing the multichannel meter output with separate scalar meters
+static double meterbench_multi(const float* const buffer, const uint32_t channels, const int kernel,
+                               const int detector, double* const separate_ns, float* const error)
+{
+    const float* in[MULTI_METER_MAX_CHANNELS];
+    Kmeterdsp separate[MULTI_METER_MAX_CHANNELS], reference[MULTI_METER_MAX_CHANNELS];
+    MultiMeter multi;
+
+    for (uint32_t c = 0; c < channels; ++c)
+    {
+        in[c] = buffer + c * METERBENCH_MULTI_SPREAD;
+
+        separate[c].select_kernel(kernel);
+        reference[c].select_kernel(Kmeterdsp::KERNEL_SCALAR);
+
+        separate[c].set_detector(detector);
+        reference[c].set_detector(detector);
+
+        separate[c].init(METERBENCH_SAMPLE_RATE, METERBENCH_MULTI_BLOCK, 0.25f, 30.0f);
+        reference[c].init(METERBENCH_SAMPLE_RATE, METERBENCH_MULTI_BLOCK, 0.25f, 30.0f);
+    }
+
+    multi_meter_select_kernel(&multi, (MultiMeterKernelType)kernel);
+    multi_meter_init(&multi, channels, METERBENCH_SAMPLE_RATE, METERBENCH_MULTI_BLOCK, 0.25f, 30.0f);
+    multi_meter_set_detector(&multi, detector);
+
+    int64_t total = 0, separate_total = 0;
+    *error = 0.0f;
+
+    // both in the same loop, so that they see the same clock and cache conditions
+    for (uint32_t i = 0; i + METERBENCH_MULTI_BLOCK <= METERBENCH_FRAMES; i += METERBENCH_MULTI_BLOCK)
+    {
+        int64_t start = meterbench_now();
+        for (uint32_t c = 0; c < channels; ++c)
+            separate[c].process(in[c] + i, METERBENCH_MULTI_BLOCK);
+        separate_total += meterbench_now() - start;
+
+        start = meterbench_now();
+        multi_meter_process(&multi, in, i, METERBENCH_MULTI_BLOCK);
+        total += meterbench_now() - start;
+
+        for (uint32_t c = 0; c < channels; ++c)
+        {
+            const float diff = fabsf(multi.level[c] - reference[c].process(in[c] + i, METERBENCH_MULTI_BLOCK));
+
+            if (diff > *error)
+                *error = diff;
+        }
+    }
+
+    const double samples = (double)(METERBENCH_FRAMES / METERBENCH_MULTI_BLOCK) * METERBENCH_MULTI_BLOCK * channels;
+
+    *separate_ns = separate_total / samples;
+    return total / samples;
+}
+
+int main(void)
+{
+    const uint32_t frames = METERBENCH_FRAMES + (MULTI_METER_MAX_CHANNELS - 1) * METERBENCH_MULTI_SPREAD;
+    float* const buffer = (float*)malloc(sizeof(float) * frames);
+
+    if (buffer == NULL)
+        return 1;
+
+    meterbench_fill(buffer, frames);
+
+    static const char* const detector_names[Kmeterdsp::DETECTOR_COUNT] = { "peak", "rms" };
+
+    printf("%-8s %-8s %6s %12s %10s %8s %10s\n",
+           "kernel", "detector", "block", "ns/block", "ns/frame", "speedup", "max error");
+
+    for (uint32_t b = 0; b < sizeof(kBlockSizes) / sizeof(kBlockSizes[0]); ++b)
+    {
+        const int block_size = kBlockSizes[b];
+        double scalar_ns = 0.0;
+
+        for (int kernel = Kmeterdsp::KERNEL_SCALAR; kernel < Kmeterdsp::KERNEL_COUNT; ++kernel)
+        {
+            Kmeterdsp probe;
+
+            if (! probe.select_kernel(kernel))
+                continue;
+
+            // RMS first, so the speedup of both detectors is against the full scalar meter
+            for (int detector = Kmeterdsp::DETECTOR_COUNT - 1; detector >= 0; --detector)
+            {
+                float error;
+                const double ns_per_block = meterbench_kernel(buffer, kernel, detector, block_size, &error);
+
+                if (kernel == Kmeterdsp::KERNEL_SCALAR && detector == Kmeterdsp::DETECTOR_RMS)
+                    scalar_ns = ns_per_block;
+
+                printf("%-8s %-8s %6d %12.1f %10.3f %7.2fx %10.2g\n",
+                       Kmeterdsp::kernel_name(kernel), detector_names[detector], block_size,
+                       ns_per_block, ns_per_block / block_size, scalar_ns / ns_per_block, error);
+            }
+        }
+    }
+
+    // times per channel and frame, of the separate meters and of the multichannel one
+    printf("\n%-8s %-8s %8s %10s %10s %8s %10s\n",
+           "kernel", "detector", "channels", "separate", "multi", "speedup", "max error");
+
+    for (uint32_t n = 0; n < sizeof(kChannels) / sizeof(kChannels[0]); ++n)
+    {
+        const uint32_t channels = kChannels[n];
+
+        for (int detector = Kmeterdsp::DETECTOR_COUNT - 1; detector >= 0; --detector)
+        {
+            // the kernel types of both meters have the same values
+            for (int kernel = MULTI_METER_KERNEL_SCALAR; kernel < MULTI_METER_KERNEL_COUNT; ++kernel)
+            {
+                MultiMeter probe;
+
+                if (! multi_meter_select_kernel(&probe, (MultiMeterKernelType)kernel))
+                    continue;
+
+                double separate_ns;
+                float error;
+                const double ns = meterbench_multi(buffer, channels, kernel, detector, &separate_ns, &error);
+
+                printf("%-8s %-8s %8u %10.3f %10.3f %7.2fx %10.2g\n",
+                       multi_meter_kernel_name((MultiMeterKernelType)kernel), detector_names[detector], channels,
+                       separate_ns, ns, separate_ns / ns, error);
+            }
+        }
+    }
+
+    free(buffer);
+    return 0;
+}
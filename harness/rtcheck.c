@@ -0,0 +1,351 @@
+/*
+ * Real-time safety check, runs each given plugin bundle with generated traffic
+ * and fails if its run() calls anything that may allocate, lock, sleep or do I/O.
+ *
+ * The functions below replace the libc ones for the whole process, including the plugins,
+ * so this must be linked with -rdynamic. Calls are only recorded while inside run(),
+ * then forwarded to libc as usual. Only glibc is supported.
+ *
+ * Each plugin is run at several block sizes and event densities with default controls,
+ * then again with each input control set to its minimum and maximum, so mode changes are covered too.
+ *
+ * Usage: rtcheck <bundle.lv2>...
+ */
+
+#define _GNU_SOURCE
+
+#include "host.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+static const uint32_t kBlockSizes[] = { 16, 256, 4096 };
+static const uint32_t kDensities[]  = { 0, 10, 1000 };
+
+#define RTCHECK_RUNS 8
+#define RTCHECK_MAX_VIOLATIONS 32
+
+typedef struct {
+    const char* function;
+    uint32_t count;
+} RtViolation;
+
+static volatile bool rtcheck_in_run = false;
+static RtViolation rtcheck_violations[RTCHECK_MAX_VIOLATIONS];
+static uint32_t rtcheck_num_violations = 0;
+
+// record a call to `function` if it happened inside run(), must not allocate
+static void rtcheck_flag(const char* const function)
+{
+    if (! rtcheck_in_run)
+        return;
+
+    for (uint32_t i = 0; i < rtcheck_num_violations; ++i)
+    {
+        if (rtcheck_violations[i].function == function)
+        {
+            ++rtcheck_violations[i].count;
+            return;
+        }
+    }
+
+    if (rtcheck_num_violations == RTCHECK_MAX_VIOLATIONS)
+        return;
+
+    rtcheck_violations[rtcheck_num_violations].function = function;
+    rtcheck_violations[rtcheck_num_violations].count = 1;
+    ++rtcheck_num_violations;
+}
+
+// look up the libc version of an interposed function
+#define RTCHECK_REAL(ret, name, args) \
+    static ret (*real) args = NULL; \
+    if (real == NULL) \
+        real = (ret (*) args)dlsym(RTLD_NEXT, #name)
+
+// --------------------------------------------------------------------------------------------------------------------
+// Memory, forwarded to the glibc internals directly since dlsym may allocate itself
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void  __libc_free(void* ptr);
+
+void* malloc(size_t size)
+{
+    rtcheck_flag("malloc");
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    rtcheck_flag("calloc");
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    rtcheck_flag("realloc");
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr)
+{
+    rtcheck_flag("free");
+    __libc_free(ptr);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    rtcheck_flag("aligned_alloc");
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    rtcheck_flag("posix_memalign");
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr != NULL ? 0 : ENOMEM;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Locking and sleeping
+
+int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+    rtcheck_flag("pthread_mutex_lock");
+    RTCHECK_REAL(int, pthread_mutex_lock, (pthread_mutex_t*));
+    return real(mutex);
+}
+
+int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex)
+{
+    rtcheck_flag("pthread_cond_wait");
+    RTCHECK_REAL(int, pthread_cond_wait, (pthread_cond_t*, pthread_mutex_t*));
+    return real(cond, mutex);
+}
+
+int pthread_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* abstime)
+{
+    rtcheck_flag("pthread_cond_timedwait");
+    RTCHECK_REAL(int, pthread_cond_timedwait, (pthread_cond_t*, pthread_mutex_t*, const struct timespec*));
+    return real(cond, mutex, abstime);
+}
+
+int sem_wait(sem_t* sem)
+{
+    rtcheck_flag("sem_wait");
+    RTCHECK_REAL(int, sem_wait, (sem_t*));
+    return real(sem);
+}
+
+int nanosleep(const struct timespec* req, struct timespec* rem)
+{
+    rtcheck_flag("nanosleep");
+    RTCHECK_REAL(int, nanosleep, (const struct timespec*, struct timespec*));
+    return real(req, rem);
+}
+
+int usleep(useconds_t usec)
+{
+    rtcheck_flag("usleep");
+    RTCHECK_REAL(int, usleep, (useconds_t));
+    return real(usec);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// I/O
+
+ssize_t read(int fd, void* buf, size_t count)
+{
+    rtcheck_flag("read");
+    RTCHECK_REAL(ssize_t, read, (int, void*, size_t));
+    return real(fd, buf, count);
+}
+
+ssize_t write(int fd, const void* buf, size_t count)
+{
+    rtcheck_flag("write");
+    RTCHECK_REAL(ssize_t, write, (int, const void*, size_t));
+    return real(fd, buf, count);
+}
+
+int printf(const char* format, ...)
+{
+    rtcheck_flag("printf");
+    va_list args;
+    va_start(args, format);
+    const int ret = vprintf(format, args);
+    va_end(args);
+    return ret;
+}
+
+int fprintf(FILE* stream, const char* format, ...)
+{
+    rtcheck_flag("fprintf");
+    va_list args;
+    va_start(args, format);
+    const int ret = vfprintf(stream, format, args);
+    va_end(args);
+    return ret;
+}
+
+// used instead of the above when building with _FORTIFY_SOURCE
+int __printf_chk(int flag, const char* format, ...)
+{
+    rtcheck_flag("printf");
+    va_list args;
+    va_start(args, format);
+    const int ret = vprintf(format, args);
+    va_end(args);
+    return ret;
+}
+
+int __fprintf_chk(FILE* stream, int flag, const char* format, ...)
+{
+    rtcheck_flag("fprintf");
+    va_list args;
+    va_start(args, format);
+    const int ret = vfprintf(stream, format, args);
+    va_end(args);
+    return ret;
+}
+
+int puts(const char* s)
+{
+    rtcheck_flag("puts");
+    RTCHECK_REAL(int, puts, (const char*));
+    return real(s);
+}
+
+int fputs(const char* s, FILE* stream)
+{
+    rtcheck_flag("fputs");
+    RTCHECK_REAL(int, fputs, (const char*, FILE*));
+    return real(s, stream);
+}
+
+int putchar(int c)
+{
+    rtcheck_flag("putchar");
+    RTCHECK_REAL(int, putchar, (int));
+    return real(c);
+}
+
+int fputc(int c, FILE* stream)
+{
+    rtcheck_flag("fputc");
+    RTCHECK_REAL(int, fputc, (int, FILE*));
+    return real(c, stream);
+}
+
+size_t fwrite(const void* ptr, size_t size, size_t count, FILE* stream)
+{
+    rtcheck_flag("fwrite");
+    RTCHECK_REAL(size_t, fwrite, (const void*, size_t, size_t, FILE*));
+    return real(ptr, size, count, stream);
+}
+
+int fflush(FILE* stream)
+{
+    rtcheck_flag("fflush");
+    RTCHECK_REAL(int, fflush, (FILE*));
+    return real(stream);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void rtcheck_run(HarnessPlugin* const plugin)
+{
+    for (uint32_t b = 0; b < sizeof(kBlockSizes) / sizeof(kBlockSizes[0]); ++b)
+    {
+        for (uint32_t d = 0; d < sizeof(kDensities) / sizeof(kDensities[0]); ++d)
+        {
+            harness_fill_inputs(plugin, kBlockSizes[b], kDensities[d]);
+
+            for (uint32_t i = 0; i < RTCHECK_RUNS; ++i)
+            {
+                harness_reset_outputs(plugin);
+
+                rtcheck_in_run = true;
+                plugin->descriptor->run(plugin->handle, kBlockSizes[b]);
+                rtcheck_in_run = false;
+
+                harness_do_work(plugin);
+            }
+        }
+    }
+}
+
+// run `plugin` with default controls, then with each input control at its minimum and maximum
+static bool rtcheck_plugin(HarnessPlugin* const plugin)
+{
+    rtcheck_num_violations = 0;
+
+    rtcheck_run(plugin);
+
+    for (uint32_t p = 0; p < plugin->num_ports; ++p)
+    {
+        HarnessPort* const port = &plugin->ports[p];
+
+        if (port->type != HARNESS_PORT_CONTROL || ! port->input)
+            continue;
+
+        port->control = port->minimum;
+        rtcheck_run(plugin);
+
+        port->control = port->maximum;
+        rtcheck_run(plugin);
+
+        port->control = port->default_value;
+        rtcheck_run(plugin);
+    }
+
+    if (rtcheck_num_violations == 0)
+    {
+        printf("%-24s OK\n", plugin->name);
+        return true;
+    }
+
+    printf("%-24s FAILED, run() called:", plugin->name);
+
+    for (uint32_t i = 0; i < rtcheck_num_violations; ++i)
+        printf(" %s (%u)", rtcheck_violations[i].function, rtcheck_violations[i].count);
+
+    printf("\n");
+    return false;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <bundle.lv2>...\n", argv[0]);
+        return 1;
+    }
+
+    int ret = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        HarnessPlugin plugin;
+
+        if (! harness_load(&plugin, argv[i]))
+        {
+            ret = 1;
+            continue;
+        }
+
+        if (! rtcheck_plugin(&plugin))
+            ret = 1;
+
+        harness_unload(&plugin);
+    }
+
+    return ret;
+}
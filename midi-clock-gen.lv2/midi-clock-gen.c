@@ -0,0 +1,749 @@
+/*
+ */
+
+#include <lv2/lv2plug.in/ns/lv2core/lv2.h>
+#include <lv2/lv2plug.in/ns/ext/atom/util.h>
+#include <lv2/lv2plug.in/ns/ext/midi/midi.h>
+#include <lv2/lv2plug.in/ns/ext/time/time.h>
+#include <lv2/lv2plug.in/ns/ext/urid/urid.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "../common/midiclock.h"
+#include "../common/spillqueue.h"
+
+#ifdef MOD_RUN_STATS
+# include "../common/runstats.h"
+#endif
+
+// tempo resolution of the clock, in fractions of a BPM
+#define BPM_RESOLUTION 1000
+
+// tempo range, as in the TTL
+#define MIN_BPM 20.0
+#define MAX_BPM 300.0
+
+typedef enum {
+    PORT_TIME_IN = 0,
+    PORT_EVENTS_OUT,
+    PORT_CTRL_SOURCE,
+    PORT_CTRL_BPM,
+    PORT_CTRL_PLAY,
+    PORT_CTRL_SEND_MTC,
+    PORT_CTRL_MTC_RATE,
+    PORT_CTRL_OUT_PLAY_STATUS,
+    PORT_CTRL_OUT_DROPPED,
+    PORT_CTRL_OUT_DEFERRED,
+} PortEnum;
+
+// values of `PORT_CTRL_SOURCE` port, as defined in the TTL
+typedef enum {
+    SOURCE_HOST = 0,
+    SOURCE_INTERNAL
+} Source;
+
+// Fixed-point phase accumulator, ticking at the exact rate of `step / period` ticks per frame.
+// Everything is an integer so no error builds up over time, however long it runs.
+// The phase can be set below zero to delay the next tick by more than a period.
+typedef struct {
+    int64_t phase; // a tick is due once this reaches `period`
+    int64_t step;  // added every frame
+    int64_t period;
+} Phase;
+
+typedef struct {
+    LV2_Atom_Event event;
+    uint8_t        msg[MIDI_MTC_FULL_FRAME_SIZE];
+} LV2_Atom_MIDI;
+
+typedef struct {
+    // URIDs
+    LV2_URID urid_atomBlank;
+    LV2_URID urid_atomDouble;
+    LV2_URID urid_atomFloat;
+    LV2_URID urid_atomInt;
+    LV2_URID urid_atomLong;
+    LV2_URID urid_atomObject;
+    LV2_URID urid_atomSequence;
+    LV2_URID urid_midiEvent;
+    LV2_URID urid_timePosition;
+    LV2_URID urid_timeBar;
+    LV2_URID urid_timeBarBeat;
+    LV2_URID urid_timeBeat;
+    LV2_URID urid_timeBeatsPerBar;
+    LV2_URID urid_timeBeatsPerMinute;
+    LV2_URID urid_timeFrame;
+    LV2_URID urid_timeSpeed;
+
+    // data flow ports
+    const LV2_Atom_Sequence* port_time_in;
+    LV2_Atom_Sequence* port_events_out;
+
+    // control ports
+    const float* port_ctrl_source;
+    const float* port_ctrl_bpm;
+    const float* port_ctrl_play;
+    const float* port_ctrl_send_mtc;
+    const float* port_ctrl_mtc_rate;
+    float* port_ctrl_out_play_status;
+    float* port_ctrl_out_dropped;
+    float* port_ctrl_out_deferred;
+
+    // internal state
+    bool needs_reset;
+    int64_t sample_rate;
+    uint32_t out_capacity;
+    SpillQueue spill;
+
+    Phase clock; // ticks on each clock pulse
+    Phase mtc;   // ticks on each MTC quarter-frame, only while rolling
+
+    bool rolling;
+    uint8_t pending;         // start or continue, sent right before a clock pulse
+    uint32_t pending_pulses; // clock pulses to send before the pending message
+    int64_t pending_frames;  // song position in frames once the pending message is sent
+    int64_t song_pulses;     // song position of the next clock pulse, while rolling
+    int64_t song_frames;     // song position in frames, while rolling
+    int64_t located_pulses;  // song position sent with the last song position pointer
+    int64_t quarter_frames;  // MTC quarter-frames from the song start to the next one
+
+    // last control values
+    Source source;
+    float bpm;
+    bool play;
+    bool send_mtc;
+    int mtc_rate;
+    bool host_tempo; // the host gave a tempo, used instead of the control one
+
+#ifdef MOD_RUN_STATS
+    RunStats* stats;
+#endif
+} Data;
+
+static int64_t phase_frames_until_tick(const Phase* const phase)
+{
+    if (phase->phase >= phase->period)
+        return 0;
+
+    return (phase->period - phase->phase + phase->step - 1) / phase->step;
+}
+
+static void write_message(Data* const self, const uint32_t frame, const uint8_t* const msg, const uint32_t size)
+{
+    LV2_Atom_MIDI ev;
+    memset(&ev, 0, sizeof(LV2_Atom_MIDI));
+
+    ev.event.time.frames = frame;
+    ev.event.body.size = size;
+    ev.event.body.type = self->urid_midiEvent;
+    memcpy(ev.msg, msg, size);
+
+    spill_queue_write(&self->spill, self->port_events_out, self->out_capacity, &ev.event);
+}
+
+static void write_status(Data* const self, const uint32_t frame, const uint8_t status)
+{
+    write_message(self, frame, &status, 1);
+}
+
+static void set_tempo(Data* const self, double bpm)
+{
+    if (bpm < MIN_BPM)
+        bpm = MIN_BPM;
+    else if (bpm > MAX_BPM)
+        bpm = MAX_BPM;
+
+    // the phase is kept as is, so the pulse in progress gets the new tempo from here on
+    self->clock.step = (int64_t)(bpm * BPM_RESOLUTION + 0.5) * MIDI_CLOCK_PPQN;
+}
+
+static void set_mtc_rate(Data* const self, const int rate)
+{
+    self->mtc_rate = rate;
+    self->mtc.step = 4 * kMTCFrameRateNum[rate];
+    self->mtc.period = self->sample_rate * kMTCFrameRateDen[rate];
+}
+
+// MTC frames since the song start at `frames`
+static int64_t mtc_frame_count(const Data* const self, const int64_t frames)
+{
+    return frames * kMTCFrameRateNum[self->mtc_rate] / (self->sample_rate * kMTCFrameRateDen[self->mtc_rate]);
+}
+
+// hours, minutes, seconds and frames of the MTC frame `count`
+static void mtc_timecode(const int rate, int64_t count, int timecode[4])
+{
+    const int64_t fps = (kMTCFrameRateNum[rate] + kMTCFrameRateDen[rate] - 1) / kMTCFrameRateDen[rate];
+
+    // drop-frame skips frames 0 and 1 of every minute, except every 10th minute
+    if (rate == MIDI_MTC_RATE_DROP_FRAME)
+    {
+        const int64_t tens = count / 17982;
+        const int64_t rest = count % 17982;
+
+        count += 18 * tens + (rest > 1 ? 2 * ((rest - 2) / 1798) : 0);
+    }
+
+    timecode[0] = (int)(count / (fps * 3600) % 24);
+    timecode[1] = (int)(count / (fps * 60) % 60);
+    timecode[2] = (int)(count / fps % 60);
+    timecode[3] = (int)(count % fps);
+}
+
+// line up the quarter-frames with the song position, called when starting to roll
+static void mtc_sync(Data* const self)
+{
+    Phase* const mtc = &self->mtc;
+
+    // first quarter-frame at or after the song position, due once the phase covers the remainder
+    const int64_t position = self->song_frames * mtc->step;
+
+    self->quarter_frames = (position + mtc->period - 1) / mtc->period;
+    mtc->phase = mtc->period - (self->quarter_frames * mtc->period - position);
+}
+
+// MTC full frame message with the time at `frames`, lets followers locate right away
+static void write_mtc_full_frame(Data* const self, const uint32_t frame, const int64_t frames)
+{
+    int timecode[4];
+    mtc_timecode(self->mtc_rate, mtc_frame_count(self, frames), timecode);
+
+    const uint8_t msg[MIDI_MTC_FULL_FRAME_SIZE] = {
+        kMidiSysEx, 0x7F, 0x7F, 0x01, 0x01,
+        (uint8_t)(timecode[0] | (self->mtc_rate << 5)), (uint8_t)timecode[1], (uint8_t)timecode[2], (uint8_t)timecode[3],
+        0xF7
+    };
+
+    write_message(self, frame, msg, sizeof(msg));
+}
+
+static void write_mtc_quarter_frame(Data* const self, const uint32_t frame)
+{
+    // each set of 8 pieces carries the time of its first one
+    const int piece = (int)(self->quarter_frames & 7);
+    int timecode[4];
+    int value;
+
+    mtc_timecode(self->mtc_rate, (self->quarter_frames - piece) / 4, timecode);
+
+    switch (piece)
+    {
+    case 0: value = timecode[3] & 0xf; break;
+    case 1: value = timecode[3] >> 4; break;
+    case 2: value = timecode[2] & 0xf; break;
+    case 3: value = timecode[2] >> 4; break;
+    case 4: value = timecode[1] & 0xf; break;
+    case 5: value = timecode[1] >> 4; break;
+    case 6: value = timecode[0] & 0xf; break;
+    default: value = (timecode[0] >> 4) | (self->mtc_rate << 1); break;
+    }
+
+    const uint8_t msg[2] = { kMidiTimeCodeQuarterFrame, (uint8_t)((piece << 4) | value) };
+
+    write_message(self, frame, msg, sizeof(msg));
+    ++self->quarter_frames;
+}
+
+static void write_clock_pulse(Data* const self, const uint32_t frame)
+{
+    if (self->pending != 0)
+    {
+        if (self->pending_pulses != 0)
+        {
+            --self->pending_pulses;
+        }
+        else
+        {
+            write_status(self, frame, self->pending);
+
+            *self->port_ctrl_out_play_status = self->pending == kMidiClockStart ? kPlayStatusStart : kPlayStatusContinue;
+
+            self->rolling = true;
+            self->pending = 0;
+            self->song_frames = self->pending_frames;
+
+            if (self->send_mtc)
+                mtc_sync(self);
+        }
+    }
+
+    write_status(self, frame, kMidiClock);
+
+    if (self->rolling)
+        ++self->song_pulses;
+}
+
+// send clock pulses and quarter-frames due from `frame` until `end`
+static void generate(Data* const self, uint32_t frame, const uint32_t end)
+{
+    for (;;)
+    {
+        const bool mtc = self->rolling && self->send_mtc;
+        int64_t frames = phase_frames_until_tick(&self->clock);
+
+        if (mtc && phase_frames_until_tick(&self->mtc) < frames)
+            frames = phase_frames_until_tick(&self->mtc);
+
+        if (frames > end - frame)
+            frames = end - frame;
+
+        self->clock.phase += frames * self->clock.step;
+
+        if (mtc)
+            self->mtc.phase += frames * self->mtc.step;
+        if (self->rolling)
+            self->song_frames += frames;
+
+        frame += frames;
+
+        if (frame == end)
+            return;
+
+        if (self->clock.phase >= self->clock.period)
+        {
+            self->clock.phase -= self->clock.period;
+            write_clock_pulse(self, frame);
+        }
+
+        // rolling may have just started with the pulse above
+        if (self->rolling && self->send_mtc && self->mtc.phase >= self->mtc.period)
+        {
+            self->mtc.phase -= self->mtc.period;
+            write_mtc_quarter_frame(self, frame);
+        }
+    }
+}
+
+static void stop(Data* const self, const uint32_t frame)
+{
+    if (! self->rolling && self->pending == 0)
+        return;
+
+    write_status(self, frame, kMidiClockStop);
+    *self->port_ctrl_out_play_status = kPlayStatusStop;
+
+    self->rolling = false;
+    self->pending = 0;
+}
+
+// start rolling from the song start, with a clock pulse right away
+static void start(Data* const self, const uint32_t frame)
+{
+    self->clock.phase = self->clock.period;
+    self->pending = kMidiClockStart;
+    self->pending_pulses = 0;
+    self->pending_frames = 0;
+    self->song_pulses = 0;
+    self->located_pulses = 0;
+
+    if (self->send_mtc)
+        write_mtc_full_frame(self, frame, 0);
+}
+
+// while stopped, move followers to `beats` quarter notes, which is `frames` into the song,
+// and start rolling from there if `roll` is set
+static void locate(Data* const self, const uint32_t frame, const double beats, const int64_t frames, const bool roll)
+{
+    const double pulses = beats > 0.0 ? beats * MIDI_CLOCK_PPQN : 0.0;
+
+    // song position pointer only goes by 16th notes, rolling starts from the next one
+    int64_t spp = (int64_t)((pulses + MIDI_CLOCK_SPP_PULSES - 1e-6) / MIDI_CLOCK_SPP_PULSES);
+
+    if (spp > 16383)
+        spp = 16383;
+
+    const uint8_t msg[3] = { kMidiSongPositionPointer, (uint8_t)(spp & 0x7f), (uint8_t)(spp >> 7) };
+
+    write_message(self, frame, msg, sizeof(msg));
+
+    if (self->send_mtc)
+        write_mtc_full_frame(self, frame, frames);
+
+    self->song_pulses = self->located_pulses = spp * MIDI_CLOCK_SPP_PULSES;
+
+    if (! roll)
+        return;
+
+    // lay the clock pulses on the song grid, the pending continue goes right before the 16th note pulse
+    const double distance = self->song_pulses - pulses;
+    const double fraction = distance - (int64_t)distance;
+    const double frames_per_pulse = (double)self->clock.period / self->clock.step;
+
+    self->clock.phase = self->clock.period - (int64_t)(fraction * self->clock.period);
+    self->pending = kMidiClockContinue;
+    self->pending_pulses = (uint32_t)distance;
+    self->pending_frames = frames + (int64_t)(distance * frames_per_pulse + 0.5);
+}
+
+// follow a host time position received at `frame`
+static void host_position(Data* const self, const uint32_t frame, const LV2_Atom_Object* const obj)
+{
+    const LV2_Atom* bar = NULL;
+    const LV2_Atom* bar_beat = NULL;
+    const LV2_Atom* beat = NULL;
+    const LV2_Atom* beats_per_bar = NULL;
+    const LV2_Atom* bpm = NULL;
+    const LV2_Atom* position = NULL;
+    const LV2_Atom* speed = NULL;
+
+    lv2_atom_object_get(obj,
+                        self->urid_timeBar, &bar,
+                        self->urid_timeBarBeat, &bar_beat,
+                        self->urid_timeBeat, &beat,
+                        self->urid_timeBeatsPerBar, &beats_per_bar,
+                        self->urid_timeBeatsPerMinute, &bpm,
+                        self->urid_timeFrame, &position,
+                        self->urid_timeSpeed, &speed,
+                        0);
+
+    // hosts are not all using the same atom types for numbers
+    #define ATOM_NUMBER(atom) \
+        ((atom)->type == self->urid_atomFloat  ? ((const LV2_Atom_Float*)(atom))->body  : \
+         (atom)->type == self->urid_atomDouble ? ((const LV2_Atom_Double*)(atom))->body : \
+         (atom)->type == self->urid_atomInt    ? ((const LV2_Atom_Int*)(atom))->body    : \
+         (atom)->type == self->urid_atomLong   ? ((const LV2_Atom_Long*)(atom))->body   : 0.0)
+
+    if (bpm != NULL && ATOM_NUMBER(bpm) > 0.0)
+    {
+        set_tempo(self, ATOM_NUMBER(bpm));
+        self->host_tempo = true;
+    }
+
+    if (speed == NULL)
+        return;
+
+    const bool has_beats = (bar != NULL && bar_beat != NULL && beats_per_bar != NULL) || beat != NULL;
+    double beats;
+
+    if (bar != NULL && bar_beat != NULL && beats_per_bar != NULL)
+        beats = ATOM_NUMBER(bar) * ATOM_NUMBER(beats_per_bar) + ATOM_NUMBER(bar_beat);
+    else if (beat != NULL)
+        beats = ATOM_NUMBER(beat);
+    else
+        beats = 0.0;
+
+    const int64_t frames = position != NULL
+                         ? (int64_t)ATOM_NUMBER(position)
+                         : (int64_t)(beats * MIDI_CLOCK_PPQN * self->clock.period / self->clock.step);
+    const bool rolling = ATOM_NUMBER(speed) > 0.0;
+
+    #undef ATOM_NUMBER
+
+    if (! rolling)
+    {
+        stop(self, frame);
+
+        // pass on where the host was moved to
+        if (has_beats && (beats * MIDI_CLOCK_PPQN < self->located_pulses - MIDI_CLOCK_SPP_PULSES ||
+            beats * MIDI_CLOCK_PPQN > self->located_pulses))
+            locate(self, frame, beats, frames, false);
+        return;
+    }
+
+    if (self->pending != 0)
+        return;
+
+    if (self->rolling)
+    {
+        // only a tempo change
+        if (! has_beats)
+            return;
+
+        // the position of the clock right now, compared to the host
+        const double pulses = self->song_pulses - 1 + (double)self->clock.phase / self->clock.period;
+        const double error = beats * MIDI_CLOCK_PPQN - pulses;
+
+        if (error > -1.0 && error < 1.0)
+            return;
+
+        stop(self, frame);
+    }
+
+    if (beats * MIDI_CLOCK_PPQN < 0.5)
+        start(self, frame);
+    else
+        locate(self, frame, beats, frames, true);
+}
+
+static LV2_Handle instantiate(const LV2_Descriptor*     descriptor,
+                              double                    rate,
+                              const char*               path,
+                              const LV2_Feature* const* features)
+{
+    Data* self = (Data*)calloc(1, sizeof(Data));
+
+    // Get host features
+    const LV2_URID_Map* map = NULL;
+
+    for (int i = 0; features[i]; ++i) {
+        if (!strcmp(features[i]->URI, LV2_URID__map)) {
+            map = (const LV2_URID_Map*)features[i]->data;
+            break;
+        }
+    }
+    if (!map) {
+        free(self);
+        return NULL;
+    }
+
+#ifdef MOD_RUN_STATS
+    self->stats = run_stats_new();
+
+    if (!self->stats) {
+        free(self);
+        return NULL;
+    }
+#endif
+
+    // Map URIs
+    self->urid_atomBlank    = map->map(map->handle, LV2_ATOM__Blank);
+    self->urid_atomDouble   = map->map(map->handle, LV2_ATOM__Double);
+    self->urid_atomFloat    = map->map(map->handle, LV2_ATOM__Float);
+    self->urid_atomInt      = map->map(map->handle, LV2_ATOM__Int);
+    self->urid_atomLong     = map->map(map->handle, LV2_ATOM__Long);
+    self->urid_atomObject   = map->map(map->handle, LV2_ATOM__Object);
+    self->urid_atomSequence = map->map(map->handle, LV2_ATOM__Sequence);
+    self->urid_midiEvent    = map->map(map->handle, LV2_MIDI__MidiEvent);
+
+    self->urid_timePosition       = map->map(map->handle, LV2_TIME__Position);
+    self->urid_timeBar            = map->map(map->handle, LV2_TIME__bar);
+    self->urid_timeBarBeat        = map->map(map->handle, LV2_TIME__barBeat);
+    self->urid_timeBeat           = map->map(map->handle, LV2_TIME__beat);
+    self->urid_timeBeatsPerBar    = map->map(map->handle, LV2_TIME__beatsPerBar);
+    self->urid_timeBeatsPerMinute = map->map(map->handle, LV2_TIME__beatsPerMinute);
+    self->urid_timeFrame          = map->map(map->handle, LV2_TIME__frame);
+    self->urid_timeSpeed          = map->map(map->handle, LV2_TIME__speed);
+
+    self->sample_rate = (int64_t)(rate + 0.5);
+    self->clock.period = 60 * BPM_RESOLUTION * self->sample_rate;
+
+    return self;
+}
+
+static void connect_port(LV2_Handle instance, uint32_t port, void* data)
+{
+    Data* const self = (Data*)instance;
+
+    switch (port)
+    {
+    case PORT_TIME_IN:
+            self->port_time_in = (const LV2_Atom_Sequence*)data;
+            break;
+    case PORT_EVENTS_OUT:
+            self->port_events_out = (LV2_Atom_Sequence*)data;
+            break;
+    case PORT_CTRL_SOURCE:
+            self->port_ctrl_source = (const float*)data;
+            break;
+    case PORT_CTRL_BPM:
+            self->port_ctrl_bpm = (const float*)data;
+            break;
+    case PORT_CTRL_PLAY:
+            self->port_ctrl_play = (const float*)data;
+            break;
+    case PORT_CTRL_SEND_MTC:
+            self->port_ctrl_send_mtc = (const float*)data;
+            break;
+    case PORT_CTRL_MTC_RATE:
+            self->port_ctrl_mtc_rate = (const float*)data;
+            break;
+    case PORT_CTRL_OUT_PLAY_STATUS:
+            self->port_ctrl_out_play_status = (float*)data;
+            break;
+    case PORT_CTRL_OUT_DROPPED:
+            self->port_ctrl_out_dropped = (float*)data;
+            break;
+    case PORT_CTRL_OUT_DEFERRED:
+            self->port_ctrl_out_deferred = (float*)data;
+            break;
+    }
+}
+
+static void activate(LV2_Handle instance)
+{
+    Data* const self = (Data*)instance;
+
+    spill_queue_reset(&self->spill);
+
+    self->clock.phase = 0;
+    self->rolling = false;
+    self->pending = 0;
+    self->song_pulses = 0;
+    self->song_frames = 0;
+    self->located_pulses = 0;
+
+    // controls are taken on the next run
+    self->needs_reset = true;
+}
+
+static void run(LV2_Handle instance, uint32_t sample_count)
+{
+    Data* const self = (Data*)instance;
+
+#ifdef MOD_RUN_STATS
+    const uint64_t run_start = run_stats_ticks();
+    uint32_t events = 0;
+#endif
+
+    // Get the capacity
+    self->out_capacity = self->port_events_out->atom.size;
+
+    // Write an empty Sequence header to the output port
+    lv2_atom_sequence_clear(self->port_events_out);
+
+    // Set port type
+    self->port_events_out->atom.type = self->urid_atomSequence;
+
+    // Send what did not fit last time first
+    spill_queue_flush(&self->spill, self->port_events_out, self->out_capacity);
+
+    // Take control changes at the start of the block
+    const Source source = *self->port_ctrl_source > 0.5f ? SOURCE_INTERNAL : SOURCE_HOST;
+    const float bpm = *self->port_ctrl_bpm;
+    const bool play = *self->port_ctrl_play > 0.5f;
+    const bool send_mtc = *self->port_ctrl_send_mtc > 0.5f;
+    const int mtc_rate = (int)(*self->port_ctrl_mtc_rate + 0.5f) & 3;
+
+    if (self->needs_reset)
+    {
+        *self->port_ctrl_out_play_status = kPlayStatusUndefined;
+
+        set_tempo(self, bpm);
+        set_mtc_rate(self, mtc_rate);
+        self->source = source;
+        self->bpm = bpm;
+        self->play = false;
+        self->send_mtc = send_mtc;
+        self->host_tempo = false;
+        self->needs_reset = false;
+    }
+
+    if (source != self->source)
+    {
+        stop(self, 0);
+        set_tempo(self, bpm);
+        self->source = source;
+        self->play = false;
+        self->host_tempo = false;
+    }
+
+    // the host tempo replaces the control one once known
+    if (bpm != self->bpm)
+    {
+        if (! self->host_tempo)
+            set_tempo(self, bpm);
+        self->bpm = bpm;
+    }
+
+    if (mtc_rate != self->mtc_rate || send_mtc != self->send_mtc)
+    {
+        set_mtc_rate(self, mtc_rate);
+        self->send_mtc = send_mtc;
+
+        if (self->rolling && send_mtc)
+            mtc_sync(self);
+    }
+
+    if (source == SOURCE_INTERNAL && play != self->play)
+    {
+        if (play)
+            start(self, 0);
+        else
+            stop(self, 0);
+        self->play = play;
+    }
+
+    // Follow host time positions, generating everything due up to each of them
+    uint32_t frame = 0;
+
+    if (source == SOURCE_HOST)
+    {
+        LV2_ATOM_SEQUENCE_FOREACH(self->port_time_in, ev)
+        {
+            if (ev->body.type != self->urid_atomObject && ev->body.type != self->urid_atomBlank)
+                continue;
+
+            const LV2_Atom_Object* const obj = (const LV2_Atom_Object*)&ev->body;
+
+            if (obj->body.otype != self->urid_timePosition)
+                continue;
+
+            const uint32_t ev_frame = ev->time.frames < sample_count ? (uint32_t)ev->time.frames : sample_count;
+
+            if (ev_frame > frame)
+            {
+                generate(self, frame, ev_frame);
+                frame = ev_frame;
+            }
+
+            host_position(self, frame, obj);
+
+#ifdef MOD_RUN_STATS
+            ++events;
+#endif
+        }
+    }
+
+    generate(self, frame, sample_count);
+
+    *self->port_ctrl_out_dropped  = self->spill.dropped;
+    *self->port_ctrl_out_deferred = self->spill.deferred;
+
+#ifdef MOD_RUN_STATS
+    run_stats_end(self->stats, run_start, sample_count, events);
+#endif
+}
+
+static void cleanup(LV2_Handle instance)
+{
+#ifdef MOD_RUN_STATS
+    run_stats_free(((Data*)instance)->stats);
+#endif
+    free((Data*)instance);
+}
+
+#ifdef MOD_RUN_STATS
+static bool snapshot_run_stats(LV2_Handle instance, RunStats* stats)
+{
+    return run_stats_snapshot(((Data*)instance)->stats, stats);
+}
+#endif
+
+static const void* extension_data(const char* uri)
+{
+#ifdef MOD_RUN_STATS
+    static const MOD_Run_Stats_Interface run_stats = { snapshot_run_stats };
+
+    if (!strcmp(uri, MOD_RUN_STATS__interface))
+        return &run_stats;
+#endif
+
+    return NULL;
+}
+
+static const LV2_Descriptor descriptor = {
+    .URI = "http://moddevices.com/plugins/mod-devel/midi-clock-gen",
+    .instantiate = instantiate,
+    .connect_port = connect_port,
+    .activate = activate,
+    .run = run,
+    .deactivate = NULL,
+    .cleanup = cleanup,
+    .extension_data = extension_data
+};
+
+#ifdef MOD_BUNDLE_DESCRIPTOR
+// built as part of the combined bundle, see mod-midi-utilities.lv2
+__attribute__((visibility("hidden")))
+const LV2_Descriptor* MOD_BUNDLE_DESCRIPTOR(void)
+{
+    return &descriptor;
+}
+#else
+LV2_SYMBOL_EXPORT
+const LV2_Descriptor* lv2_descriptor(uint32_t index)
+{
+    return (index == 0) ? &descriptor : NULL;
+}
+#endif
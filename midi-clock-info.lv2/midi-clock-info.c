@@ -2,16 +2,61 @@
  */
 
 #include <lv2/lv2plug.in/ns/lv2core/lv2.h>
+#include <lv2/lv2plug.in/ns/ext/atom/forge.h>
 #include <lv2/lv2plug.in/ns/ext/atom/util.h>
 #include <lv2/lv2plug.in/ns/ext/midi/midi.h>
+#include <lv2/lv2plug.in/ns/ext/time/time.h>
 #include <lv2/lv2plug.in/ns/ext/urid/urid.h>
+#include <lv2/lv2plug.in/ns/ext/log/log.h>
+#include <lv2/lv2plug.in/ns/ext/worker/worker.h>
 
+#include <math.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "../common/midiclock.h"
+
+#ifdef MOD_RUN_STATS
+# include "../common/runstats.h"
+#endif
+
+// Log MTC, SPP and transport changes.
+// Messages are queued from run() and written later by the host worker thread,
+// to the host log if available or stdout otherwise.
 #define DEBUG_PLUGIN_LOG
 
+// number of log messages that can be pending, must be a power of 2
+#define LOG_RING_SIZE 64
+
+// Clock DLL bandwidth in Hz once locked, lower is more stable under jitter but slower to follow tempo changes
+#define CLOCK_DLL_BANDWIDTH 0.5
+
+// Clock DLL loop gain right after (re)locking, narrowed down to the bandwidth above over CLOCK_DLL_LOCK_PULSES pulses
+#define CLOCK_DLL_LOCK_GAIN 0.5
+#define CLOCK_DLL_LOCK_PULSES MIDI_CLOCK_PPQN
+
+// a gap longer than this many clock periods means the clock was lost, the DLL locks again on the next pulses
+#define CLOCK_DLL_MAX_GAP 4.0
+
+// intervals this many periods long or more are counted as missing pulses, not as jitter
+#define CLOCK_MISSING_GAP 1.5
+
+// time positions are sent for 4/4, as MIDI clock has no notion of bars
+#define POSITION_BEATS_PER_BAR 4
+
+// tempo changes smaller than this are not sent as new time positions
+#define POSITION_BPM_STEP 0.1f
+
+// enough room in the output for a time position event
+#define POSITION_EVENT_SIZE 256
+
+// fraction of the position error corrected on each quarter-frame, larger errors than a frame jump right away
+#define MTC_RESYNC_GAIN 0.5
+
+// quarter-frames missing for longer than this many frames means MTC stopped, the position then stays put
+#define MTC_TIMEOUT_FRAMES 2.0
+
 typedef enum {
     PORT_RAW_MIDI_IN = 0,
     PORT_CTRL_OUT_PLAY_STATUS,
@@ -20,25 +65,116 @@ typedef enum {
     PORT_CTRL_OUT_MTC_MINUTES,
     PORT_CTRL_OUT_MTC_HOURS,
     PORT_CTRL_OUT_SONG_POSITION_POINTER,
-    // TODO raw BPM based on clock pulse
-    // TODO filtered BPM
-    // TODO BPM/clock-pulse drift
+    PORT_CTRL_OUT_LOG_DROPPED,
+    PORT_CTRL_OUT_RAW_BPM,
+    PORT_CTRL_OUT_FILTERED_BPM,
+    PORT_CTRL_OUT_CLOCK_DRIFT,
+    PORT_CTRL_OUT_MTC_RATE,
+    PORT_CTRL_OUT_MTC_POSITION_SECONDS,
+    PORT_CTRL_OUT_MTC_POSITION_SAMPLES,
+    PORT_TIME_OUT,
+    PORT_CTRL_OUT_CLOCK_JITTER,
+    PORT_CTRL_OUT_CLOCK_MAX_DEVIATION,
+    PORT_CTRL_OUT_CLOCK_MISSING,
+    PORT_CTRL_OUT_CLOCK_TIMEOUTS,
 } PortEnum;
 
 typedef struct {
-    int frame, frameLSB;
-    int seconds, secondsLSB;
-    int minutes, minutesLSB;
-    int hours, hoursLSB;
+    int frame;
+    int seconds;
+    int minutes;
+    int hours;
+    int rate; // frame rate bits, 0 = 24, 1 = 25, 2 = 29.97 drop-frame, 3 = 30 fps
+    // quarter-frame assembly
+    uint8_t values[8]; // value of each piece
+    uint8_t pieces;    // bitmask of the pieces received for the current time
+    int last_piece; // -1 if none yet
+    bool reverse;   // pieces are arriving in descending order
+    bool running;   // quarter-frames keep following each other, so `position` is valid
+    double position; // timecode in seconds at the last quarter-frame
 } MTC;
 
+// MTC position extrapolated in between quarter-frames, in seconds, times are in frames since activate
+typedef struct {
+    double position; // position at `time`
+    double time;
+    double speed;    // 1 going forward, -1 in reverse, 0 when stopped
+} MTCLocator;
+
+// frames per second for an MTC rate
+static inline double mtc_frame_rate(const int rate)
+{
+    return (double)kMTCFrameRateNum[rate] / kMTCFrameRateDen[rate];
+}
+
+// Second order delay-locked loop following the MIDI clock pulses,
+// see "Using a DLL to filter time" by Fons Adriaensen.
+// All times are in frames since activate.
+typedef struct {
+    uint32_t pulses;  // pulses received since (re)locking
+    double last;      // time of the last pulse, as received
+    double predicted; // filtered time of the next pulse
+    double period;    // filtered time between pulses
+    double error;     // last pulse time minus its predicted time
+} ClockDLL;
+
+// Running statistics of the clock pulse intervals, as deviations from the DLL period in frames.
+// Variance is kept with Welford's online algorithm.
+typedef struct {
+    uint32_t count;
+    double mean;
+    double m2; // sum of squared differences from the mean
+    double max_deviation;
+    uint32_t missing;  // pulses missing in between others
+    uint32_t timeouts; // times the clock stopped without a MIDI stop
+} ClockStats;
+
+typedef enum {
+    LOG_RESET = 0,
+    LOG_MTC,
+    LOG_SONG_POSITION_POINTER,
+    LOG_PLAY_STATUS
+} LogType;
+
+// a log message, formatted only once out of the audio thread
+typedef struct {
+    LogType type;
+    int values[4];
+} LogRecord;
+
+// single producer (run), single consumer (worker) queue of log messages
+typedef struct {
+    LogRecord records[LOG_RING_SIZE];
+    uint32_t write_pos; // only written by run
+    uint32_t read_pos;  // only written by the worker
+    uint32_t dropped;   // messages lost because the queue was full
+} LogRing;
+
 typedef struct {
     // URIDs
     LV2_URID urid_atomSequence;
     LV2_URID urid_midiEvent;
+    LV2_URID urid_logNote;
+    LV2_URID urid_timePosition;
+    LV2_URID urid_timeBar;
+    LV2_URID urid_timeBarBeat;
+    LV2_URID urid_timeBeat;
+    LV2_URID urid_timeBeatUnit;
+    LV2_URID urid_timeBeatsPerBar;
+    LV2_URID urid_timeBeatsPerMinute;
+    LV2_URID urid_timeFrame;
+    LV2_URID urid_timeSpeed;
+
+    // atom forge for time positions
+    LV2_Atom_Forge forge;
+
+    // host features
+    const LV2_Log_Log* log;
+    const LV2_Worker_Schedule* schedule;
 
     // data flow ports
     const LV2_Atom_Sequence* port_events_in;
+    LV2_Atom_Sequence* port_time_out;
 
     // control ports
     float* port_ctrl_out_play_status;
@@ -47,17 +183,299 @@ typedef struct {
     float* port_ctrl_out_mtc_minutes;
     float* port_ctrl_out_mtc_hours;
     float* port_ctrl_out_song_pos_ptr;
+    float* port_ctrl_out_log_dropped;
+    float* port_ctrl_out_raw_bpm;
+    float* port_ctrl_out_filtered_bpm;
+    float* port_ctrl_out_clock_drift;
+    float* port_ctrl_out_mtc_rate;
+    float* port_ctrl_out_mtc_position_seconds;
+    float* port_ctrl_out_mtc_position_samples;
+    float* port_ctrl_out_clock_jitter;
+    float* port_ctrl_out_clock_max_deviation;
+    float* port_ctrl_out_clock_missing;
+    float* port_ctrl_out_clock_timeouts;
 
     // internal state
     bool needs_reset;
+    double sample_rate;
+    uint64_t frame; // frames processed since activate
     MTC mtc;
+    MTCLocator locator;
+    ClockDLL clock;
+    ClockStats clock_stats;
+
+    // transport as sent in time positions
+    bool playing;
+    bool first_pulse; // the next clock pulse is at `song_pulses`, after start and continue
+    int64_t song_pulses; // clock pulses since the song start
+    float bpm; // 0 while unknown
+
+    // pending log messages
+    LogRing log_ring;
+
+#ifdef MOD_RUN_STATS
+    RunStats* stats;
+#endif
 } Data;
 
-// values of `PORT_CTRL_OUT_PLAY_STATUS` port, as defined in the TTL
-static const float kPlayStatusUndefined = 0.0f;
-static const float kPlayStatusStart = 1.0f;
-static const float kPlayStatusStop = 2.0f;
-static const float kPlayStatusContinue = 3.0f;
+static void clock_dll_reset(ClockDLL* const dll)
+{
+    dll->pulses = 0;
+    dll->error = 0.0;
+}
+
+// number of pulses missing right before a pulse at `time`, once the period is known
+static uint32_t clock_dll_missing(const ClockDLL* const dll, const double time)
+{
+    if (dll->pulses < 2 || time - dll->last < CLOCK_MISSING_GAP * dll->period)
+        return 0;
+
+    return (uint32_t)((time - dll->last) / dll->period + 0.5) - 1;
+}
+
+// feed a clock pulse received at `time`, returns false while not locked yet
+// gaps longer than CLOCK_DLL_MAX_GAP periods must be handled by resetting first
+static bool clock_dll_pulse(ClockDLL* const dll, const double time, const double sample_rate)
+{
+    switch (dll->pulses)
+    {
+    case 0:
+        break;
+
+    case 1:
+        // the first interval gives the initial period, ignore pulses with no time in between
+        if (time <= dll->last)
+            return false;
+
+        dll->period = time - dll->last;
+        dll->predicted = time + dll->period;
+        dll->error = 0.0;
+        break;
+
+    default: {
+        // loop gain for the wanted bandwidth at the current period, wider while locking
+        double gain = 2.0 * 3.14159265358979 * CLOCK_DLL_BANDWIDTH * dll->period / sample_rate;
+
+        if (dll->pulses < CLOCK_DLL_LOCK_PULSES)
+            gain += (CLOCK_DLL_LOCK_GAIN - gain) * (CLOCK_DLL_LOCK_PULSES - dll->pulses) / CLOCK_DLL_LOCK_PULSES;
+        if (gain > CLOCK_DLL_LOCK_GAIN)
+            gain = CLOCK_DLL_LOCK_GAIN;
+
+        // skip over missing pulses instead of taking them as a tempo change
+        dll->predicted += clock_dll_missing(dll, time) * dll->period;
+
+        dll->error = time - dll->predicted;
+        dll->predicted += 1.41421356237310 * gain * dll->error + dll->period;
+        dll->period += gain * gain * dll->error;
+        break;
+    }
+    }
+
+    dll->last = time;
+    ++dll->pulses;
+    return dll->pulses > 2;
+}
+
+static void mtc_reset(MTC* const mtc)
+{
+    memset(mtc, 0, sizeof(*mtc));
+    mtc->last_piece = -1;
+}
+
+// current timecode in seconds
+static double mtc_seconds(const MTC* const mtc)
+{
+    const int seconds = mtc->hours * 3600 + mtc->minutes * 60 + mtc->seconds;
+
+    if (mtc->rate != MIDI_MTC_RATE_DROP_FRAME)
+        return seconds + mtc->frame / mtc_frame_rate(mtc->rate);
+
+    // drop-frame skips frames 0 and 1 of every minute, except every 10th minute
+    const int minutes = mtc->hours * 60 + mtc->minutes;
+    const int frames = seconds * 30 + mtc->frame - 2 * (minutes - minutes / 10);
+
+    return frames / mtc_frame_rate(MIDI_MTC_RATE_DROP_FRAME);
+}
+
+// take a new quarter-frame piece, returns true once all 8 pieces of a time have been received
+static bool mtc_quarter_frame(MTC* const mtc, const int type, const int value)
+{
+    // pieces go 0 to 7 while playing forward and 7 to 0 in reverse,
+    // anything else is a jump so the pieces received so far are discarded
+    const bool forward = type == ((mtc->last_piece + 1) & 7);
+    const bool reverse = type == ((mtc->last_piece - 1) & 7);
+
+    if (mtc->last_piece < 0 || (! forward && ! reverse) || reverse != mtc->reverse)
+    {
+        mtc->pieces = 0;
+        mtc->reverse = mtc->last_piece >= 0 && reverse;
+        mtc->running = false;
+    }
+
+    mtc->last_piece = type;
+    mtc->values[type] = value;
+    mtc->pieces |= 1 << type;
+
+    // each quarter-frame moves the timecode by a quarter of a frame
+    if (mtc->running)
+        mtc->position += (mtc->reverse ? -0.25 : 0.25) / mtc_frame_rate(mtc->rate);
+
+    // the last piece is 7 going forward, 0 in reverse
+    if (mtc->pieces != 0xff || type != (mtc->reverse ? 0 : 7))
+        return false;
+
+    mtc->pieces = 0;
+    mtc->frame   = mtc->values[0] + ((mtc->values[1] & 0x1) * 16);
+    mtc->seconds = mtc->values[2] + ((mtc->values[3] & 0x3) * 16);
+    mtc->minutes = mtc->values[4] + ((mtc->values[5] & 0x3) * 16);
+    mtc->hours   = mtc->values[6] + ((mtc->values[7] & 0x1) * 16);
+    mtc->rate    = (mtc->values[7] >> 1) & 0x3;
+
+    // the time was sent starting 7 quarter-frames ago
+    mtc->running  = true;
+    mtc->position = mtc_seconds(mtc) + (mtc->reverse ? -1.75 : 1.75) / mtc_frame_rate(mtc->rate);
+    return true;
+}
+
+// take a full-frame message (F0 7F <device> 01 01 hh mm ss ff F7), sent by masters on locate
+static bool mtc_full_frame(MTC* const mtc, const uint8_t* const msg, const uint32_t size)
+{
+    if (size != MIDI_MTC_FULL_FRAME_SIZE || msg[1] != 0x7F || msg[3] != 0x01 || msg[4] != 0x01 || msg[9] != 0xF7)
+        return false;
+
+    mtc->hours   = msg[5] & 0x1f;
+    mtc->rate    = (msg[5] >> 5) & 0x3;
+    mtc->minutes = msg[6] & 0x3f;
+    mtc->seconds = msg[7] & 0x3f;
+    mtc->frame   = msg[8] & 0x1f;
+
+    // quarter-frames start over from the new position
+    mtc->pieces = 0;
+    mtc->last_piece = -1;
+    mtc->running = false;
+    return true;
+}
+
+static double mtc_locator_position(const MTCLocator* const locator, const double time, const double sample_rate)
+{
+    return locator->position + locator->speed * (time - locator->time) / sample_rate;
+}
+
+// follow the timecode after a quarter-frame received at `time`,
+// small errors are corrected over the next quarter-frames instead of jumping
+static void mtc_locator_sync(MTCLocator* const locator, const MTC* const mtc, const double time, const double sample_rate)
+{
+    const double predicted = mtc_locator_position(locator, time, sample_rate);
+    const double error = mtc->position - predicted;
+    const double frame = 1.0 / mtc_frame_rate(mtc->rate);
+
+    if (locator->speed == 0.0 || error > frame || error < -frame)
+        locator->position = mtc->position;
+    else
+        locator->position = predicted + MTC_RESYNC_GAIN * error;
+
+    locator->time = time;
+    locator->speed = mtc->reverse ? -1.0 : 1.0;
+}
+
+// place the locator at the current timecode without moving, for full-frame messages
+static void mtc_locator_locate(MTCLocator* const locator, const MTC* const mtc, const double time)
+{
+    locator->position = mtc_seconds(mtc);
+    locator->time = time;
+    locator->speed = 0.0;
+}
+
+// stop moving once quarter-frames stopped coming
+static void mtc_locator_check_timeout(MTCLocator* const locator, const MTC* const mtc, const double time, const double sample_rate)
+{
+    const double timeout = MTC_TIMEOUT_FRAMES * sample_rate / mtc_frame_rate(mtc->rate);
+
+    if (locator->speed == 0.0 || time - locator->time <= timeout)
+        return;
+
+    locator->position = mtc_locator_position(locator, locator->time + timeout, sample_rate);
+    locator->time += timeout;
+    locator->speed = 0.0;
+}
+
+static void clock_stats_add(ClockStats* const stats, const double deviation)
+{
+    const double delta = deviation - stats->mean;
+
+    ++stats->count;
+    stats->mean += delta / stats->count;
+    stats->m2 += delta * (deviation - stats->mean);
+
+    if (fabs(deviation) > stats->max_deviation)
+        stats->max_deviation = fabs(deviation);
+}
+
+// queue a log message, called from run
+static void log_push(Data* const self, const LogType type, const int v0, const int v1, const int v2, const int v3)
+{
+    LogRing* const ring = &self->log_ring;
+    const uint32_t write_pos = ring->write_pos;
+
+    // nothing would ever read it
+    if (self->schedule == NULL)
+    {
+        ++ring->dropped;
+        return;
+    }
+
+    if (write_pos - __atomic_load_n(&ring->read_pos, __ATOMIC_ACQUIRE) == LOG_RING_SIZE)
+    {
+        ++ring->dropped;
+        return;
+    }
+
+    LogRecord* const record = &ring->records[write_pos % LOG_RING_SIZE];
+    record->type = type;
+    record->values[0] = v0;
+    record->values[1] = v1;
+    record->values[2] = v2;
+    record->values[3] = v3;
+
+    __atomic_store_n(&ring->write_pos, write_pos + 1, __ATOMIC_RELEASE);
+}
+
+// write out a log message, called from the worker thread
+static void log_write(const Data* const self, const LogRecord* const record)
+{
+    char msg[128];
+
+    switch (record->type)
+    {
+    case LOG_RESET:
+        snprintf(msg, sizeof(msg), "MIDI Clock Info: reset\n");
+        break;
+    case LOG_MTC:
+        snprintf(msg, sizeof(msg), "MIDI Clock Info: MTC -> %02i:%02i:%02i:%03i\n",
+                 record->values[0], record->values[1], record->values[2], record->values[3]);
+        break;
+    case LOG_SONG_POSITION_POINTER:
+        snprintf(msg, sizeof(msg), "MIDI Clock Info: song pos ptr -> %i\n", record->values[0]);
+        break;
+    case LOG_PLAY_STATUS:
+        snprintf(msg, sizeof(msg), "MIDI Clock Info: play status -> %s\n",
+                 record->values[0] == (int)kPlayStatusStart ? "start" :
+                 record->values[0] == (int)kPlayStatusStop ? "stop" : "continue");
+        break;
+    default:
+        return;
+    }
+
+    if (self->log != NULL)
+    {
+        self->log->printf(self->log->handle, self->urid_logNote, "%s", msg);
+    }
+    else
+    {
+        fputs(msg, stdout);
+        fflush(stdout);
+    }
+}
 
 static LV2_Handle instantiate(const LV2_Descriptor*     descriptor,
                               double                    rate,
@@ -72,7 +490,10 @@ static LV2_Handle instantiate(const LV2_Descriptor*     descriptor,
     for (int i = 0; features[i]; ++i) {
         if (!strcmp(features[i]->URI, LV2_URID__map)) {
             map = (const LV2_URID_Map*)features[i]->data;
-            break;
+        } else if (!strcmp(features[i]->URI, LV2_LOG__log)) {
+            self->log = (const LV2_Log_Log*)features[i]->data;
+        } else if (!strcmp(features[i]->URI, LV2_WORKER__schedule)) {
+            self->schedule = (const LV2_Worker_Schedule*)features[i]->data;
         }
     }
     if (!map) {
@@ -80,9 +501,33 @@ static LV2_Handle instantiate(const LV2_Descriptor*     descriptor,
         return NULL;
     }
 
+#ifdef MOD_RUN_STATS
+    self->stats = run_stats_new();
+
+    if (!self->stats) {
+        free(self);
+        return NULL;
+    }
+#endif
+
     // Map URIs
     self->urid_atomSequence = map->map(map->handle, LV2_ATOM__Sequence);
     self->urid_midiEvent    = map->map(map->handle, LV2_MIDI__MidiEvent);
+    self->urid_logNote      = map->map(map->handle, LV2_LOG__Note);
+
+    self->urid_timePosition       = map->map(map->handle, LV2_TIME__Position);
+    self->urid_timeBar            = map->map(map->handle, LV2_TIME__bar);
+    self->urid_timeBarBeat        = map->map(map->handle, LV2_TIME__barBeat);
+    self->urid_timeBeat           = map->map(map->handle, LV2_TIME__beat);
+    self->urid_timeBeatUnit       = map->map(map->handle, LV2_TIME__beatUnit);
+    self->urid_timeBeatsPerBar    = map->map(map->handle, LV2_TIME__beatsPerBar);
+    self->urid_timeBeatsPerMinute = map->map(map->handle, LV2_TIME__beatsPerMinute);
+    self->urid_timeFrame          = map->map(map->handle, LV2_TIME__frame);
+    self->urid_timeSpeed          = map->map(map->handle, LV2_TIME__speed);
+
+    lv2_atom_forge_init(&self->forge, map);
+
+    self->sample_rate = rate;
 
     return self;
 }
@@ -114,6 +559,42 @@ static void connect_port(LV2_Handle instance, uint32_t port, void* data)
     case PORT_CTRL_OUT_SONG_POSITION_POINTER:
             self->port_ctrl_out_song_pos_ptr = (float*)data;
             break;
+    case PORT_CTRL_OUT_LOG_DROPPED:
+            self->port_ctrl_out_log_dropped = (float*)data;
+            break;
+    case PORT_CTRL_OUT_RAW_BPM:
+            self->port_ctrl_out_raw_bpm = (float*)data;
+            break;
+    case PORT_CTRL_OUT_FILTERED_BPM:
+            self->port_ctrl_out_filtered_bpm = (float*)data;
+            break;
+    case PORT_CTRL_OUT_CLOCK_DRIFT:
+            self->port_ctrl_out_clock_drift = (float*)data;
+            break;
+    case PORT_CTRL_OUT_MTC_RATE:
+            self->port_ctrl_out_mtc_rate = (float*)data;
+            break;
+    case PORT_CTRL_OUT_MTC_POSITION_SECONDS:
+            self->port_ctrl_out_mtc_position_seconds = (float*)data;
+            break;
+    case PORT_CTRL_OUT_MTC_POSITION_SAMPLES:
+            self->port_ctrl_out_mtc_position_samples = (float*)data;
+            break;
+    case PORT_TIME_OUT:
+            self->port_time_out = (LV2_Atom_Sequence*)data;
+            break;
+    case PORT_CTRL_OUT_CLOCK_JITTER:
+            self->port_ctrl_out_clock_jitter = (float*)data;
+            break;
+    case PORT_CTRL_OUT_CLOCK_MAX_DEVIATION:
+            self->port_ctrl_out_clock_max_deviation = (float*)data;
+            break;
+    case PORT_CTRL_OUT_CLOCK_MISSING:
+            self->port_ctrl_out_clock_missing = (float*)data;
+            break;
+    case PORT_CTRL_OUT_CLOCK_TIMEOUTS:
+            self->port_ctrl_out_clock_timeouts = (float*)data;
+            break;
     }
 }
 
@@ -122,12 +603,113 @@ static void activate(LV2_Handle instance)
     Data* const self = (Data*)instance;
 
     self->needs_reset = true;
-    memset(&self->mtc, 0, sizeof(self->mtc));
+    self->frame = 0;
+    mtc_reset(&self->mtc);
+    memset(&self->locator, 0, sizeof(self->locator));
+    clock_dll_reset(&self->clock);
+    memset(&self->clock_stats, 0, sizeof(self->clock_stats));
+
+    self->playing = false;
+    self->first_pulse = false;
+    self->song_pulses = 0;
+    self->bpm = 0.0f;
+}
+
+static void publish_mtc(Data* const self)
+{
+    *self->port_ctrl_out_mtc_frame = self->mtc.frame;
+    *self->port_ctrl_out_mtc_seconds = self->mtc.seconds;
+    *self->port_ctrl_out_mtc_minutes = self->mtc.minutes;
+    *self->port_ctrl_out_mtc_hours = self->mtc.hours;
+    *self->port_ctrl_out_mtc_rate = self->mtc.rate;
+#ifdef DEBUG_PLUGIN_LOG
+    log_push(self, LOG_MTC, self->mtc.hours, self->mtc.minutes, self->mtc.seconds, self->mtc.frame);
+#endif
+}
+
+// send the current transport as a time position at `frame` of this block
+static void write_position(Data* const self, const int64_t frame)
+{
+    LV2_Atom_Forge* const forge = &self->forge;
+    LV2_Atom_Forge_Frame object;
+
+    // never send a partial object
+    if (forge->offset + POSITION_EVENT_SIZE > forge->size)
+        return;
+
+    const int64_t bar_pulses = MIDI_CLOCK_PPQN * POSITION_BEATS_PER_BAR;
+
+    lv2_atom_forge_frame_time(forge, frame);
+    lv2_atom_forge_object(forge, &object, 0, self->urid_timePosition);
+
+    lv2_atom_forge_key(forge, self->urid_timeSpeed);
+    lv2_atom_forge_float(forge, self->playing ? 1.0f : 0.0f);
+
+    lv2_atom_forge_key(forge, self->urid_timeBar);
+    lv2_atom_forge_long(forge, self->song_pulses / bar_pulses);
+
+    lv2_atom_forge_key(forge, self->urid_timeBarBeat);
+    lv2_atom_forge_float(forge, (float)(self->song_pulses % bar_pulses) / MIDI_CLOCK_PPQN);
+
+    lv2_atom_forge_key(forge, self->urid_timeBeat);
+    lv2_atom_forge_double(forge, (double)self->song_pulses / MIDI_CLOCK_PPQN);
+
+    lv2_atom_forge_key(forge, self->urid_timeBeatUnit);
+    lv2_atom_forge_int(forge, 4);
+
+    lv2_atom_forge_key(forge, self->urid_timeBeatsPerBar);
+    lv2_atom_forge_float(forge, POSITION_BEATS_PER_BAR);
+
+    // tempo and song position in frames are only known once locked to the clock
+    if (self->bpm > 0.0f)
+    {
+        lv2_atom_forge_key(forge, self->urid_timeBeatsPerMinute);
+        lv2_atom_forge_float(forge, self->bpm);
+
+        lv2_atom_forge_key(forge, self->urid_timeFrame);
+        lv2_atom_forge_long(forge, (int64_t)(self->song_pulses * 60.0 * self->sample_rate / (MIDI_CLOCK_PPQN * self->bpm)));
+    }
+
+    lv2_atom_forge_pop(forge, &object);
+}
+
+// detect the clock stopping without a MIDI stop, at the exact frame it was due,
+// called before each event at `time` and at the end of each block
+static void check_clock_timeout(Data* const self, const double time)
+{
+    if (self->clock.pulses < 2)
+        return;
+
+    const double deadline = self->clock.last + CLOCK_DLL_MAX_GAP * self->clock.period;
+
+    if (time <= deadline)
+        return;
+
+    clock_dll_reset(&self->clock);
+    ++self->clock_stats.timeouts;
+
+    // transport followers stop right there, a MIDI continue or start is needed to play again
+    if (self->playing)
+    {
+        const int64_t frame = (int64_t)(deadline - self->frame);
+
+        self->playing = false;
+        write_position(self, frame > 0 ? frame : 0);
+    }
 }
 
 static void run(LV2_Handle instance, uint32_t sample_count)
 {
     Data* const self = (Data*)instance;
+    const uint32_t log_write_pos = self->log_ring.write_pos;
+
+#ifdef MOD_RUN_STATS
+    const uint64_t run_start = run_stats_ticks();
+    uint32_t events = 0;
+
+    LV2_ATOM_SEQUENCE_FOREACH(self->port_events_in, ev)
+        ++events;
+#endif
 
     if (self->needs_reset)
     {
@@ -136,14 +718,24 @@ static void run(LV2_Handle instance, uint32_t sample_count)
         *self->port_ctrl_out_mtc_seconds = 0.0f;
         *self->port_ctrl_out_mtc_minutes = 0.0f;
         *self->port_ctrl_out_mtc_hours = 0.0f;
+        *self->port_ctrl_out_mtc_rate = 0.0f;
+        *self->port_ctrl_out_mtc_position_seconds = 0.0f;
+        *self->port_ctrl_out_mtc_position_samples = 0.0f;
         *self->port_ctrl_out_song_pos_ptr = 0.0f;
+        *self->port_ctrl_out_raw_bpm = 0.0f;
+        *self->port_ctrl_out_filtered_bpm = 0.0f;
+        *self->port_ctrl_out_clock_drift = 0.0f;
         self->needs_reset = false;
 #ifdef DEBUG_PLUGIN_LOG
-        fprintf(stdout, "MIDI Clock Info: reset\n");
-        fflush(stdout);
+        log_push(self, LOG_RESET, 0, 0, 0, 0);
 #endif
     }
 
+    // Prepare time position output
+    LV2_Atom_Forge_Frame sequence;
+    lv2_atom_forge_set_buffer(&self->forge, (uint8_t*)self->port_time_out, self->port_time_out->atom.size);
+    lv2_atom_forge_sequence_head(&self->forge, &sequence, 0);
+
     // Read incoming events
     LV2_ATOM_SEQUENCE_FOREACH(self->port_events_in, ev)
     {
@@ -151,103 +743,213 @@ static void run(LV2_Handle instance, uint32_t sample_count)
         {
             const uint8_t* const msg = (const uint8_t*)(ev + 1);
 
+            check_clock_timeout(self, (double)(self->frame + ev->time.frames));
+
             switch (msg[0])
             {
-            case 0xF1: // MIDI Time Code (Quarter Frame)
-            {
-                const int type  = (msg[1] >> 4) & 0xf;
-                const int value =  msg[1] & 0xf;
-
-                switch (type)
+            case kMidiSysEx: // MIDI Time Code (Full Frame)
+                if (mtc_full_frame(&self->mtc, msg, ev->body.size))
                 {
-                case 0:
-                    self->mtc.frameLSB = value;
-                    break;
-                case 1:
-                    self->mtc.frame = self->mtc.frameLSB + (value * 16);
-                    break;
-                case 2:
-                    self->mtc.secondsLSB = value;
-                    break;
-                case 3:
-                    self->mtc.seconds = self->mtc.secondsLSB + (value * 16);
-                    break;
-                case 4:
-                    self->mtc.minutesLSB = value;
-                    break;
-                case 5:
-                    self->mtc.minutes = self->mtc.minutesLSB + (value * 16);
-                    break;
-                case 6:
-                    self->mtc.hoursLSB = value & 0x1f;
-                    break;
-                case 7:
-                    self->mtc.hours = self->mtc.hoursLSB + ((value * 16) & 0x1f);
-
-                    // only update after receiving all bits
-                    *self->port_ctrl_out_mtc_frame = self->mtc.frame;
-                    *self->port_ctrl_out_mtc_seconds = self->mtc.seconds;
-                    *self->port_ctrl_out_mtc_minutes = self->mtc.minutes;
-                    *self->port_ctrl_out_mtc_hours = self->mtc.hours;
-#ifdef DEBUG_PLUGIN_LOG
-                    fprintf(stdout, "MIDI Clock Info: MTC -> %02i:%02i:%02i:%03i\n",
-                            self->mtc.hours, self->mtc.minutes, self->mtc.seconds, self->mtc.frame);
-                    fflush(stdout);
-#endif
-                    break;
+                    publish_mtc(self);
+                    mtc_locator_locate(&self->locator, &self->mtc, (double)(self->frame + ev->time.frames));
                 }
+                break;
+
+            case kMidiTimeCodeQuarterFrame:
+                // only update after receiving all pieces
+                if (mtc_quarter_frame(&self->mtc, (msg[1] >> 4) & 0x7, msg[1] & 0xf))
+                    publish_mtc(self);
 
+                if (self->mtc.running)
+                    mtc_locator_sync(&self->locator, &self->mtc,
+                                     (double)(self->frame + ev->time.frames), self->sample_rate);
                 break;
-            }
 
-            case 0xF2: // MIDI Song Position Pointer
+            case kMidiSongPositionPointer:
             {
                 const int value = msg[1] + 128 * msg[2];
                 *self->port_ctrl_out_song_pos_ptr = value;
+
+                // song position pointer counts in 16th notes, 6 clock pulses each
+                self->song_pulses = value * MIDI_CLOCK_SPP_PULSES;
+                write_position(self, ev->time.frames);
 #ifdef DEBUG_PLUGIN_LOG
-                fprintf(stdout, "MIDI Clock Info: song pos ptr -> %i\n", value);
-                fflush(stdout);
+                log_push(self, LOG_SONG_POSITION_POINTER, value, 0, 0, 0);
 #endif
                 break;
             }
 
-            case 0xF8: // MIDI Clock "Pulse"
-                // TODO
+            case kMidiClock:
+            {
+                const double time = (double)(self->frame + ev->time.frames);
+                const double last = self->clock.last;
+
+                if (self->clock.pulses != 0 && time > last)
+                    *self->port_ctrl_out_raw_bpm = 60.0 * self->sample_rate / (MIDI_CLOCK_PPQN * (time - last));
+
+                if (self->clock.pulses > 1)
+                {
+                    const uint32_t missing = clock_dll_missing(&self->clock, time);
+
+                    if (missing != 0)
+                        self->clock_stats.missing += missing;
+                    else
+                        clock_stats_add(&self->clock_stats, time - last - self->clock.period);
+                }
+
+                if (self->playing)
+                {
+                    if (self->first_pulse)
+                        self->first_pulse = false;
+                    else
+                        ++self->song_pulses;
+                }
+
+                if (clock_dll_pulse(&self->clock, time, self->sample_rate))
+                {
+                    const float bpm = 60.0 * self->sample_rate / (MIDI_CLOCK_PPQN * self->clock.period);
+
+                    *self->port_ctrl_out_filtered_bpm = bpm;
+                    *self->port_ctrl_out_clock_drift = 1000.0 * self->clock.error / self->sample_rate;
+
+                    if (bpm - self->bpm >= POSITION_BPM_STEP || self->bpm - bpm >= POSITION_BPM_STEP)
+                    {
+                        self->bpm = bpm;
+                        write_position(self, ev->time.frames);
+                    }
+                }
                 break;
+            }
 
-            case 0xFA: // MIDI Clock Start
+            case kMidiClockStart:
+                // the first pulse comes right after, lock again from there with no previous tempo
+                clock_dll_reset(&self->clock);
+                self->playing = true;
+                self->first_pulse = true;
+                self->song_pulses = 0;
+                write_position(self, ev->time.frames);
                 *self->port_ctrl_out_play_status = kPlayStatusStart;
 #ifdef DEBUG_PLUGIN_LOG
-                fprintf(stdout, "MIDI Clock Info: play status -> start\n");
-                fflush(stdout);
+                log_push(self, LOG_PLAY_STATUS, (int)kPlayStatusStart, 0, 0, 0);
 #endif
                 break;
 
-            case 0xFB: // MIDI Clock Continue
+            case kMidiClockContinue:
+                self->playing = true;
+                self->first_pulse = true;
+                write_position(self, ev->time.frames);
                 *self->port_ctrl_out_play_status = kPlayStatusContinue;
 #ifdef DEBUG_PLUGIN_LOG
-                fprintf(stdout, "MIDI Clock Info: play status -> continue\n");
-                fflush(stdout);
+                log_push(self, LOG_PLAY_STATUS, (int)kPlayStatusContinue, 0, 0, 0);
 #endif
                 break;
 
-            case 0xFC: // MIDI Clock Stop
+            case kMidiClockStop:
+                self->playing = false;
+                write_position(self, ev->time.frames);
                 *self->port_ctrl_out_play_status = kPlayStatusStop;
 #ifdef DEBUG_PLUGIN_LOG
-                fprintf(stdout, "MIDI Clock Info: play status -> stop\n");
-                fflush(stdout);
+                log_push(self, LOG_PLAY_STATUS, (int)kPlayStatusStop, 0, 0, 0);
 #endif
                 break;
             }
         }
     }
+
+    check_clock_timeout(self, (double)(self->frame + sample_count));
+
+    lv2_atom_forge_pop(&self->forge, &sequence);
+
+    // Clock statistics, in milliseconds
+    const ClockStats* const stats = &self->clock_stats;
+
+    *self->port_ctrl_out_clock_jitter = stats->count > 1 ? 1000.0 * sqrt(stats->m2 / stats->count) / self->sample_rate : 0.0;
+    *self->port_ctrl_out_clock_max_deviation = 1000.0 * stats->max_deviation / self->sample_rate;
+    *self->port_ctrl_out_clock_missing = stats->missing;
+    *self->port_ctrl_out_clock_timeouts = stats->timeouts;
+
+    // MTC position at the start of this block, from the last quarter-frame or full-frame
+    mtc_locator_check_timeout(&self->locator, &self->mtc, (double)self->frame, self->sample_rate);
+
+    double mtc_position = mtc_locator_position(&self->locator, (double)self->frame, self->sample_rate);
+
+    if (mtc_position < 0.0)
+        mtc_position = 0.0;
+
+    *self->port_ctrl_out_mtc_position_seconds = mtc_position;
+    *self->port_ctrl_out_mtc_position_samples = mtc_position * self->sample_rate;
+
+    // Have the worker write out new log messages
+    if (self->log_ring.write_pos != log_write_pos)
+        self->schedule->schedule_work(self->schedule->handle, 0, NULL);
+
+    *self->port_ctrl_out_log_dropped = self->log_ring.dropped;
+
+    self->frame += sample_count;
+
+#ifdef MOD_RUN_STATS
+    run_stats_end(self->stats, run_start, sample_count, events);
+#endif
 }
 
 static void cleanup(LV2_Handle instance)
 {
+#ifdef MOD_RUN_STATS
+    run_stats_free(((Data*)instance)->stats);
+#endif
     free((Data*)instance);
 }
 
+static LV2_Worker_Status work(LV2_Handle                  instance,
+                              LV2_Worker_Respond_Function respond,
+                              LV2_Worker_Respond_Handle   handle,
+                              uint32_t                    size,
+                              const void*                 data)
+{
+    Data* const self = (Data*)instance;
+    LogRing* const ring = &self->log_ring;
+
+    // Write out all pending log messages
+    const uint32_t write_pos = __atomic_load_n(&ring->write_pos, __ATOMIC_ACQUIRE);
+
+    for (uint32_t read_pos = ring->read_pos; read_pos != write_pos; ++read_pos)
+    {
+        log_write(self, &ring->records[read_pos % LOG_RING_SIZE]);
+        __atomic_store_n(&ring->read_pos, read_pos + 1, __ATOMIC_RELEASE);
+    }
+
+    return LV2_WORKER_SUCCESS;
+}
+
+static LV2_Worker_Status work_response(LV2_Handle instance, uint32_t size, const void* data)
+{
+    return LV2_WORKER_SUCCESS;
+}
+
+#ifdef MOD_RUN_STATS
+static bool snapshot_run_stats(LV2_Handle instance, RunStats* stats)
+{
+    return run_stats_snapshot(((Data*)instance)->stats, stats);
+}
+#endif
+
+static const void* extension_data(const char* uri)
+{
+    static const LV2_Worker_Interface worker = { work, work_response, NULL };
+
+    if (!strcmp(uri, LV2_WORKER__interface))
+        return &worker;
+
+#ifdef MOD_RUN_STATS
+    static const MOD_Run_Stats_Interface run_stats = { snapshot_run_stats };
+
+    if (!strcmp(uri, MOD_RUN_STATS__interface))
+        return &run_stats;
+#endif
+
+    return NULL;
+}
+
 static const LV2_Descriptor descriptor = {
     .URI = "http://moddevices.com/plugins/mod-devel/midi-clock-info",
     .instantiate = instantiate,
@@ -256,11 +958,20 @@ static const LV2_Descriptor descriptor = {
     .run = run,
     .deactivate = NULL,
     .cleanup = cleanup,
-    .extension_data = NULL
+    .extension_data = extension_data
 };
 
+#ifdef MOD_BUNDLE_DESCRIPTOR
+// built as part of the combined bundle, see mod-midi-utilities.lv2
+__attribute__((visibility("hidden")))
+const LV2_Descriptor* MOD_BUNDLE_DESCRIPTOR(void)
+{
+    return &descriptor;
+}
+#else
 LV2_SYMBOL_EXPORT
 const LV2_Descriptor* lv2_descriptor(uint32_t index)
 {
     return (index == 0) ? &descriptor : NULL;
 }
+#endif
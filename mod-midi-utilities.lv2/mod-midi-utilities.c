@@ -0,0 +1,44 @@
+/*
+ * Combined bundle, exposing every plugin of this repository from a single binary.
+ * Each plugin source is built with MOD_BUNDLE_DESCRIPTOR set to the hidden accessor declared below.
+ */
+
+#include <lv2/lv2plug.in/ns/lv2core/lv2.h>
+
+#include <stddef.h>
+
+#define HIDDEN __attribute__((visibility("hidden")))
+
+HIDDEN const LV2_Descriptor* midi_clock_info_descriptor(void);
+HIDDEN const LV2_Descriptor* midi_clock_gen_descriptor(void);
+HIDDEN const LV2_Descriptor* midi_switchbox_1_2_descriptor(void);
+HIDDEN const LV2_Descriptor* midi_switchbox_1_3_descriptor(void);
+HIDDEN const LV2_Descriptor* midi_switchbox_2_1_descriptor(void);
+HIDDEN const LV2_Descriptor* midi_switchbox_3_1_descriptor(void);
+HIDDEN const LV2_Descriptor* midi_switchbox_1_2_2C_descriptor(void);
+HIDDEN const LV2_Descriptor* midi_switchbox_2_1_2C_descriptor(void);
+HIDDEN const LV2_Descriptor* peak_to_cc_2C_descriptor(void);
+HIDDEN const LV2_Descriptor* peak_to_cc_4C_descriptor(void);
+HIDDEN const LV2_Descriptor* peak_to_cc_8C_descriptor(void);
+HIDDEN const LV2_Descriptor* peak_to_cc_descriptor(void);
+
+static const LV2_Descriptor* (*const descriptors[])(void) = {
+    midi_clock_info_descriptor,
+    midi_clock_gen_descriptor,
+    midi_switchbox_1_2_descriptor,
+    midi_switchbox_1_3_descriptor,
+    midi_switchbox_2_1_descriptor,
+    midi_switchbox_3_1_descriptor,
+    midi_switchbox_1_2_2C_descriptor,
+    midi_switchbox_2_1_2C_descriptor,
+    peak_to_cc_2C_descriptor,
+    peak_to_cc_4C_descriptor,
+    peak_to_cc_8C_descriptor,
+    peak_to_cc_descriptor,
+};
+
+LV2_SYMBOL_EXPORT
+const LV2_Descriptor* lv2_descriptor(uint32_t index)
+{
+    return (index < sizeof(descriptors)/sizeof(descriptors[0])) ? descriptors[index]() : NULL;
+}
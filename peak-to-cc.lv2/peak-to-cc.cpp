@@ -3,15 +3,36 @@
 
 #include <lv2/lv2plug.in/ns/lv2core/lv2.h>
 #include <lv2/lv2plug.in/ns/ext/atom/util.h>
+#include <lv2/lv2plug.in/ns/ext/buf-size/buf-size.h>
 #include <lv2/lv2plug.in/ns/ext/midi/midi.h>
+#include <lv2/lv2plug.in/ns/ext/options/options.h>
 #include <lv2/lv2plug.in/ns/ext/urid/urid.h>
 
 #include "peakmeter/kmeterdsp.cc"
+#include "../common/spillqueue.h"
+
+#ifdef MOD_RUN_STATS
+# include "../common/runstats.h"
+#endif
+
+// meter analysis hop used when the host does not tell its block length, and the range allowed for it,
+// the hop can also be chosen by the update interval control
+#define METER_DEFAULT_HOP 128
+#define METER_MIN_HOP     16
+#define METER_MAX_HOP     4096
+
+// peak hold time in seconds and fallback rate in dB/s
+#define METER_HOLD 0.25f
+#define METER_FALL 30.0f
 
 typedef enum {
     PORT_CONTROL_TARGET = 0,
     PORT_AUDIO_IN,
-    PORT_ATOM_OUT
+    PORT_ATOM_OUT,
+    PORT_CTRL_OUT_DROPPED,
+    PORT_CTRL_OUT_DEFERRED,
+    PORT_CONTROL_DETECTOR,
+    PORT_CONTROL_HOP
 } PortEnum;
 
 typedef struct {
@@ -19,19 +40,37 @@ typedef struct {
     int prev_cc_num;
     int prev_cc_value;
 
+    // meter setup, the hop does not change with the size of each run
+    int sample_rate;
+    int block_hop; // from the host block length
+    int hop;       // in use, the update interval control or block_hop
+
     // URIDs
     LV2_URID urid_atomSequence;
     LV2_URID urid_midiEvent;
 
     // control ports
     const float* port_ctrl_target;
+    const float* port_ctrl_detector;
+    const float* port_ctrl_hop;
 
     // data flow ports
     const float* port_audio_in;
     LV2_Atom_Sequence* port_events_out;
 
+    // control output ports
+    float* port_ctrl_out_dropped;
+    float* port_ctrl_out_deferred;
+
+    // events that did not fit on the output
+    SpillQueue spill;
+
     // peak meter class
     Kmeterdsp meter;
+
+#ifdef MOD_RUN_STATS
+    RunStats* stats;
+#endif
 } Data;
 
 // Struct for a 3 byte MIDI event
@@ -49,11 +88,13 @@ static LV2_Handle instantiate(const LV2_Descriptor*     descriptor,
 
     // Get host features
     const LV2_URID_Map* map = NULL;
+    const LV2_Options_Option* options = NULL;
 
     for (int i = 0; features[i]; ++i) {
         if (!strcmp(features[i]->URI, LV2_URID__map)) {
             map = (const LV2_URID_Map*)features[i]->data;
-            break;
+        } else if (!strcmp(features[i]->URI, LV2_OPTIONS__options)) {
+            options = (const LV2_Options_Option*)features[i]->data;
         }
     }
     if (!map) {
@@ -61,10 +102,51 @@ static LV2_Handle instantiate(const LV2_Descriptor*     descriptor,
         return NULL;
     }
 
+#ifdef MOD_RUN_STATS
+    self->stats = run_stats_new();
+
+    if (!self->stats) {
+        delete self;
+        return NULL;
+    }
+#endif
+
     // Map URIs
     self->urid_atomSequence = map->map(map->handle, LV2_ATOM__Sequence);
     self->urid_midiEvent    = map->map(map->handle, LV2_MIDI__MidiEvent);
 
+    // Meter hop, the nominal block length if known, or else the maximum one
+    int nominal_block_length = 0;
+    int max_block_length = 0;
+
+    if (options) {
+        const LV2_URID urid_atomInt                   = map->map(map->handle, LV2_ATOM__Int);
+        const LV2_URID urid_bufSizeMaxBlockLength     = map->map(map->handle, LV2_BUF_SIZE__maxBlockLength);
+        const LV2_URID urid_bufSizeNominalBlockLength = map->map(map->handle, LV2_BUF_SIZE__nominalBlockLength);
+
+        for (int i = 0; options[i].key != 0; ++i) {
+            if (options[i].type != urid_atomInt)
+                continue;
+
+            if (options[i].key == urid_bufSizeNominalBlockLength)
+                nominal_block_length = *(const int32_t*)options[i].value;
+            else if (options[i].key == urid_bufSizeMaxBlockLength)
+                max_block_length = *(const int32_t*)options[i].value;
+        }
+    }
+
+    self->sample_rate = (int)(rate + 0.5);
+    self->block_hop = nominal_block_length > 0 ? nominal_block_length
+              : max_block_length > 0     ? max_block_length
+              : METER_DEFAULT_HOP;
+
+    if (self->block_hop < METER_MIN_HOP)
+        self->block_hop = METER_MIN_HOP;
+    else if (self->block_hop > METER_MAX_HOP)
+        self->block_hop = METER_MAX_HOP;
+
+    self->hop = self->block_hop;
+
     return self;
 }
 
@@ -83,6 +165,18 @@ static void connect_port(LV2_Handle instance, uint32_t port, void* data)
     case PORT_ATOM_OUT:
             self->port_events_out = (LV2_Atom_Sequence*)data;
             break;
+    case PORT_CTRL_OUT_DROPPED:
+            self->port_ctrl_out_dropped = (float*)data;
+            break;
+    case PORT_CTRL_OUT_DEFERRED:
+            self->port_ctrl_out_deferred = (float*)data;
+            break;
+    case PORT_CONTROL_DETECTOR:
+            self->port_ctrl_detector = (const float*)data;
+            break;
+    case PORT_CONTROL_HOP:
+            self->port_ctrl_hop = (const float*)data;
+            break;
     }
 }
 
@@ -92,6 +186,10 @@ static void activate(LV2_Handle instance)
 
     self->prev_cc_num = -1;
     self->prev_cc_value = -1;
+
+    self->meter.init(self->sample_rate, self->hop, METER_HOLD, METER_FALL);
+
+    spill_queue_reset(&self->spill);
 }
 
 static int midimax(int v)
@@ -99,17 +197,60 @@ static int midimax(int v)
     return v > 127 ? 127 : v;
 }
 
+// meter hop for the update interval control, 0 follows the host block length
+static int control_hop(const Data* self)
+{
+    const int hop = (int)(*self->port_ctrl_hop + 0.5f);
+
+    if (hop <= 0)
+        return self->block_hop;
+
+    return hop < METER_MIN_HOP ? METER_MIN_HOP : hop > METER_MAX_HOP ? METER_MAX_HOP : hop;
+}
+
+// send the CC at `frame` if it changed, returns true if an event was written or queued
+static bool send_cc(Data* self, uint32_t out_capacity, uint32_t frame, int cur_num, int cur_value)
+{
+    if (self->prev_cc_num == cur_num && self->prev_cc_value == cur_value)
+        return false;
+
+    LV2_Atom_MIDI msg;
+    memset(&msg, 0, sizeof(LV2_Atom_MIDI));
+
+    msg.event.time.frames = frame;
+    msg.event.body.size = 3;
+    msg.event.body.type = self->urid_midiEvent;
+
+    msg.msg[0] = LV2_MIDI_MSG_CONTROLLER;
+    msg.msg[1] = cur_num;
+    msg.msg[2] = cur_value;
+
+    self->prev_cc_num   = cur_num;
+    self->prev_cc_value = cur_value;
+
+    return spill_queue_write(&self->spill, self->port_events_out, out_capacity, (LV2_Atom_Event*)&msg);
+}
+
 static void run(LV2_Handle instance, uint32_t sample_count)
 {
     Data* self = (Data*)instance;
 
-    const float peak = fabs(self->meter.process(self->port_audio_in, sample_count));
+#ifdef MOD_RUN_STATS
+    const uint64_t run_start = run_stats_ticks();
+    uint32_t events = 0;
+#endif
 
-    const int cur_num   = (int)(*self->port_ctrl_target + 0.5f);
-    const int cur_value = midimax((int)(peak*127.0f));
+    self->meter.set_detector((int)(*self->port_ctrl_detector + 0.5f));
 
-    if (self->prev_cc_num == cur_num && self->prev_cc_value == cur_value)
-        return;
+    const int hop = control_hop(self);
+
+    if (hop != self->hop)
+    {
+        self->hop = hop;
+        self->meter.set_hop(hop);
+    }
+
+    const int cur_num = (int)(*self->port_ctrl_target + 0.5f);
 
     // Get the capacity
     const uint32_t out_capacity = self->port_events_out->atom.size;
@@ -120,27 +261,65 @@ static void run(LV2_Handle instance, uint32_t sample_count)
     // Set port type
     self->port_events_out->atom.type = self->urid_atomSequence;
 
-    LV2_Atom_MIDI msg;
-    memset(&msg, 0, sizeof(LV2_Atom_MIDI));
+    // Send what did not fit last time first
+    spill_queue_flush(&self->spill, self->port_events_out, out_capacity);
 
-    msg.event.body.size = 3;
-    msg.event.body.type = self->urid_midiEvent;
+    // Meter one hop at a time, the level only changes at the end of a hop,
+    // so that is where the CC is sent, at its own frame
+    for (uint32_t offset = 0; offset < sample_count;)
+    {
+        const uint32_t remaining = (uint32_t)self->meter.hop_remaining();
+        const uint32_t frames = remaining < sample_count - offset ? remaining : sample_count - offset;
 
-    msg.msg[0] = LV2_MIDI_MSG_CONTROLLER;
-    msg.msg[1] = cur_num;
-    msg.msg[2] = cur_value;
+        const float level = fabs(self->meter.process(self->port_audio_in + offset, frames));
+        offset += frames;
 
-    lv2_atom_sequence_append_event(self->port_events_out, out_capacity, (LV2_Atom_Event*)&msg);
+        if (frames != remaining)
+            break;
 
-    self->prev_cc_num   = cur_num;
-    self->prev_cc_value = cur_value;
+        if (send_cc(self, out_capacity, offset - 1, cur_num, midimax((int)(level*127.0f))))
+        {
+#ifdef MOD_RUN_STATS
+            ++events;
+#endif
+        }
+    }
+
+    *self->port_ctrl_out_dropped  = self->spill.dropped;
+    *self->port_ctrl_out_deferred = self->spill.deferred;
+
+#ifdef MOD_RUN_STATS
+    run_stats_end(self->stats, run_start, sample_count, events);
+#endif
 }
 
 static void cleanup(LV2_Handle instance)
 {
+#ifdef MOD_RUN_STATS
+    run_stats_free(((Data*)instance)->stats);
+#endif
     delete (Data*)instance;
 }
 
+#ifdef MOD_RUN_STATS
+static bool snapshot_run_stats(LV2_Handle instance, RunStats* stats)
+{
+    return run_stats_snapshot(((Data*)instance)->stats, stats);
+}
+#endif
+
+static const void* extension_data(const char* uri)
+{
+#ifdef MOD_RUN_STATS
+    static const MOD_Run_Stats_Interface run_stats = { snapshot_run_stats };
+
+    if (!strcmp(uri, MOD_RUN_STATS__interface))
+        return &run_stats;
+#endif
+
+    return NULL;
+}
+
 static const LV2_Descriptor descriptor = {
     .URI = "http://moddevices.com/plugins/mod-devel/PeakToCC",
     .instantiate = instantiate,
@@ -149,11 +328,20 @@ static const LV2_Descriptor descriptor = {
     .run = run,
     .deactivate = NULL,
     .cleanup = cleanup,
-    .extension_data = NULL
+    .extension_data = extension_data
 };
 
+#ifdef MOD_BUNDLE_DESCRIPTOR
+// built as part of the combined bundle, see mod-midi-utilities.lv2
+extern "C" __attribute__((visibility("hidden")))
+const LV2_Descriptor* MOD_BUNDLE_DESCRIPTOR(void)
+{
+    return &descriptor;
+}
+#else
 LV2_SYMBOL_EXPORT
 const LV2_Descriptor* lv2_descriptor(uint32_t index)
 {
     return (index == 0) ? &descriptor : NULL;
 }
+#endif
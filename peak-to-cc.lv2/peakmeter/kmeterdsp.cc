@@ -23,89 +23,469 @@
 #include <math.h>
 #include "kmeterdsp.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+# define KMETERDSP_X86
+# include <immintrin.h>
+#endif
+
+#ifdef __ARM_NEON
+# include <arm_neon.h>
+#endif
+
+
+// Scalar kernel, the reference for the vectorized ones.
+// The ballistic filters are only run for the RMS detector.
+
+template <bool rms>
+static float kernel_scalar (Kmeterdsp::Filters *f, const float *p, int n, float t)
+{
+    float  s, z0, z1, z2, wdcf, wrms;
+
+    // Get filter state.
+    z0 = f->z0;
+    z1 = f->z1;
+    z2 = f->z2;
+    wdcf = f->wdcf;
+    wrms = f->wrms;
+
+    // Find digital peak value and perform filtering on squared signal.
+    while (n--)
+    {
+        s = *p++;
+
+        if (s < -1.0f)
+            s = -1.0f;
+        else if (s > 1.0f)
+            s = 1.0f;
+
+        z0 += wdcf * (s - z0);       // DC filter
+        s -= z0;
+        s *= s;
+        if (t < s) t = s;            // Update digital peak.
+        if (rms)
+        {
+            z1 += wrms * (s - z1);   // Update first filter.
+            z2 += wrms * (z1 - z2);  // Update second filter.
+        }
+    }
+
+    // Save filter state.
+    f->z0 = z0;
+    f->z1 = z1;
+    f->z2 = z2;
+
+    return t;
+}
+
+
+// Block recursive form of the one-pole filters, for the vectorized kernels.
+//
+// The filter  z += w * (x - z)  is  z[k] = a * z[k-1] + w * x[k]  with
+// a = 1 - w, so for a vector of L samples following the state c:
+//
+//   z[k] = a^(k+1) * c + sum (j = 0..k) a^(k-j) * w * x[j]
+//
+// The sum is a prefix scan of w * x, done in log2(L) shift and
+// multiply-add steps. Only the a^(k+1) * c term depends on the
+// previous vector, through its last lane, so the serial dependency
+// is one multiply-add per vector instead of one per sample.
+
+#ifdef KMETERDSP_X86
+
+__attribute__((target("sse2")))
+static inline __m128 scan_sse2 (__m128 v, __m128 a1, __m128 a2)
+{
+    v = _mm_add_ps (v, _mm_mul_ps (a1, _mm_castsi128_ps (_mm_slli_si128 (_mm_castps_si128 (v), 4))));
+    v = _mm_add_ps (v, _mm_mul_ps (a2, _mm_castsi128_ps (_mm_slli_si128 (_mm_castps_si128 (v), 8))));
+    return v;
+}
+
+template <bool rms>
+__attribute__((target("sse2")))
+static float kernel_sse2 (Kmeterdsp::Filters *f, const float *p, int n, float t)
+{
+    const __m128 lo  = _mm_set1_ps (-1.0f);
+    const __m128 hi  = _mm_set1_ps (1.0f);
+    const __m128 wd  = _mm_set1_ps (f->wdcf);
+    const __m128 wr  = _mm_set1_ps (f->wrms);
+    const __m128 ad1 = _mm_set1_ps (f->pdcf [0]);
+    const __m128 ad2 = _mm_set1_ps (f->pdcf [1]);
+    const __m128 ar1 = _mm_set1_ps (f->prms [0]);
+    const __m128 ar2 = _mm_set1_ps (f->prms [1]);
+    const __m128 pd  = _mm_loadu_ps (f->pdcf);
+    const __m128 pr  = _mm_loadu_ps (f->prms);
+
+    __m128 s, pk, z0, z1, z2;
+
+    // Filter state in all lanes.
+    z0 = _mm_set1_ps (f->z0);
+    z1 = _mm_set1_ps (f->z1);
+    z2 = _mm_set1_ps (f->z2);
+    pk = _mm_set1_ps (t);
+
+    for (; n >= 4; n -= 4, p += 4)
+    {
+        s = _mm_min_ps (_mm_max_ps (_mm_loadu_ps (p), lo), hi);
+        z0 = _mm_add_ps (scan_sse2 (_mm_mul_ps (wd, s), ad1, ad2), _mm_mul_ps (pd, z0));
+        s = _mm_sub_ps (s, z0);
+        s = _mm_mul_ps (s, s);
+        pk = _mm_max_ps (pk, s);
+
+        // Last lane is the state for the next vector.
+        z0 = _mm_shuffle_ps (z0, z0, 0xFF);
+
+        if (rms)
+        {
+            z1 = _mm_add_ps (scan_sse2 (_mm_mul_ps (wr, s), ar1, ar2), _mm_mul_ps (pr, z1));
+            z2 = _mm_add_ps (scan_sse2 (_mm_mul_ps (wr, z1), ar1, ar2), _mm_mul_ps (pr, z2));
+            z1 = _mm_shuffle_ps (z1, z1, 0xFF);
+            z2 = _mm_shuffle_ps (z2, z2, 0xFF);
+        }
+    }
+
+    pk = _mm_max_ps (pk, _mm_shuffle_ps (pk, pk, 0x4E));
+    pk = _mm_max_ps (pk, _mm_shuffle_ps (pk, pk, 0xB1));
+
+    f->z0 = _mm_cvtss_f32 (z0);
+    f->z1 = _mm_cvtss_f32 (z1);
+    f->z2 = _mm_cvtss_f32 (z2);
+
+    // Remaining samples.
+    return kernel_scalar<rms> (f, p, n, _mm_cvtss_f32 (pk));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 scan_avx2 (__m256 v, __m256 a1, __m256 a2, __m256 a4)
+{
+    const __m256 zero = _mm256_setzero_ps ();
+    const __m256i shift1 = _mm256_setr_epi32 (7, 0, 1, 2, 3, 4, 5, 6);
+    const __m256i shift2 = _mm256_setr_epi32 (6, 7, 0, 1, 2, 3, 4, 5);
+
+    v = _mm256_fmadd_ps (a1, _mm256_blend_ps (_mm256_permutevar8x32_ps (v, shift1), zero, 0x01), v);
+    v = _mm256_fmadd_ps (a2, _mm256_blend_ps (_mm256_permutevar8x32_ps (v, shift2), zero, 0x03), v);
+    v = _mm256_fmadd_ps (a4, _mm256_permute2f128_ps (v, v, 0x08), v);
+    return v;
+}
+
+template <bool rms>
+__attribute__((target("avx2,fma")))
+static float kernel_avx2 (Kmeterdsp::Filters *f, const float *p, int n, float t)
+{
+    const __m256 lo  = _mm256_set1_ps (-1.0f);
+    const __m256 hi  = _mm256_set1_ps (1.0f);
+    const __m256 wd  = _mm256_set1_ps (f->wdcf);
+    const __m256 wr  = _mm256_set1_ps (f->wrms);
+    const __m256 ad1 = _mm256_set1_ps (f->pdcf [0]);
+    const __m256 ad2 = _mm256_set1_ps (f->pdcf [1]);
+    const __m256 ad4 = _mm256_set1_ps (f->pdcf [3]);
+    const __m256 ar1 = _mm256_set1_ps (f->prms [0]);
+    const __m256 ar2 = _mm256_set1_ps (f->prms [1]);
+    const __m256 ar4 = _mm256_set1_ps (f->prms [3]);
+    const __m256 pd  = _mm256_loadu_ps (f->pdcf);
+    const __m256 pr  = _mm256_loadu_ps (f->prms);
+    const __m256i last = _mm256_set1_epi32 (7);
+
+    __m256 s, pk, z0, z1, z2;
+    __m128 pk4;
+
+    // Filter state in all lanes.
+    z0 = _mm256_set1_ps (f->z0);
+    z1 = _mm256_set1_ps (f->z1);
+    z2 = _mm256_set1_ps (f->z2);
+    pk = _mm256_set1_ps (t);
+
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        s = _mm256_min_ps (_mm256_max_ps (_mm256_loadu_ps (p), lo), hi);
+        z0 = _mm256_fmadd_ps (pd, z0, scan_avx2 (_mm256_mul_ps (wd, s), ad1, ad2, ad4));
+        s = _mm256_sub_ps (s, z0);
+        s = _mm256_mul_ps (s, s);
+        pk = _mm256_max_ps (pk, s);
+
+        // Last lane is the state for the next vector.
+        z0 = _mm256_permutevar8x32_ps (z0, last);
+
+        if (rms)
+        {
+            z1 = _mm256_fmadd_ps (pr, z1, scan_avx2 (_mm256_mul_ps (wr, s), ar1, ar2, ar4));
+            z2 = _mm256_fmadd_ps (pr, z2, scan_avx2 (_mm256_mul_ps (wr, z1), ar1, ar2, ar4));
+            z1 = _mm256_permutevar8x32_ps (z1, last);
+            z2 = _mm256_permutevar8x32_ps (z2, last);
+        }
+    }
+
+    pk4 = _mm_max_ps (_mm256_castps256_ps128 (pk), _mm256_extractf128_ps (pk, 1));
+    pk4 = _mm_max_ps (pk4, _mm_shuffle_ps (pk4, pk4, 0x4E));
+    pk4 = _mm_max_ps (pk4, _mm_shuffle_ps (pk4, pk4, 0xB1));
+
+    f->z0 = _mm256_cvtss_f32 (z0);
+    f->z1 = _mm256_cvtss_f32 (z1);
+    f->z2 = _mm256_cvtss_f32 (z2);
+
+    // Remaining samples.
+    return kernel_scalar<rms> (f, p, n, _mm_cvtss_f32 (pk4));
+}
+
+#endif // KMETERDSP_X86
+
+#ifdef __ARM_NEON
+
+static inline float32x4_t scan_neon (float32x4_t v, float32x4_t a1, float32x4_t a2)
+{
+    const float32x4_t zero = vdupq_n_f32 (0.0f);
+
+    v = vmlaq_f32 (v, a1, vextq_f32 (zero, v, 3));
+    v = vmlaq_f32 (v, a2, vextq_f32 (zero, v, 2));
+    return v;
+}
+
+template <bool rms>
+static float kernel_neon (Kmeterdsp::Filters *f, const float *p, int n, float t)
+{
+    const float32x4_t lo  = vdupq_n_f32 (-1.0f);
+    const float32x4_t hi  = vdupq_n_f32 (1.0f);
+    const float32x4_t wd  = vdupq_n_f32 (f->wdcf);
+    const float32x4_t wr  = vdupq_n_f32 (f->wrms);
+    const float32x4_t ad1 = vdupq_n_f32 (f->pdcf [0]);
+    const float32x4_t ad2 = vdupq_n_f32 (f->pdcf [1]);
+    const float32x4_t ar1 = vdupq_n_f32 (f->prms [0]);
+    const float32x4_t ar2 = vdupq_n_f32 (f->prms [1]);
+    const float32x4_t pd  = vld1q_f32 (f->pdcf);
+    const float32x4_t pr  = vld1q_f32 (f->prms);
+
+    float32x4_t s, pk, z0, z1, z2;
+    float32x2_t pk2;
+
+    // Filter state in all lanes.
+    z0 = vdupq_n_f32 (f->z0);
+    z1 = vdupq_n_f32 (f->z1);
+    z2 = vdupq_n_f32 (f->z2);
+    pk = vdupq_n_f32 (t);
+
+    for (; n >= 4; n -= 4, p += 4)
+    {
+        s = vminq_f32 (vmaxq_f32 (vld1q_f32 (p), lo), hi);
+        z0 = vmlaq_f32 (scan_neon (vmulq_f32 (wd, s), ad1, ad2), pd, z0);
+        s = vsubq_f32 (s, z0);
+        s = vmulq_f32 (s, s);
+        pk = vmaxq_f32 (pk, s);
+
+        // Last lane is the state for the next vector.
+        z0 = vdupq_n_f32 (vgetq_lane_f32 (z0, 3));
+
+        if (rms)
+        {
+            z1 = vmlaq_f32 (scan_neon (vmulq_f32 (wr, s), ar1, ar2), pr, z1);
+            z2 = vmlaq_f32 (scan_neon (vmulq_f32 (wr, z1), ar1, ar2), pr, z2);
+            z1 = vdupq_n_f32 (vgetq_lane_f32 (z1, 3));
+            z2 = vdupq_n_f32 (vgetq_lane_f32 (z2, 3));
+        }
+    }
+
+    pk2 = vpmax_f32 (vget_low_f32 (pk), vget_high_f32 (pk));
+    pk2 = vpmax_f32 (pk2, pk2);
+
+    f->z0 = vgetq_lane_f32 (z0, 0);
+    f->z1 = vgetq_lane_f32 (z1, 0);
+    f->z2 = vgetq_lane_f32 (z2, 0);
+
+    // Remaining samples.
+    return kernel_scalar<rms> (f, p, n, vget_lane_f32 (pk2, 0));
+}
+
+#endif // __ARM_NEON
+
+
 Kmeterdsp::Kmeterdsp ()
 {
     int fsamp = 48000;
     int fsize = 128;
+    _detector = DETECTOR_PEAK;
+    select_kernel (KERNEL_AUTO);
     init (fsamp, fsize, 0.25f, 30.0f);
 }
 
 void Kmeterdsp::init (int fsamp, int fsize, float hold, float fall)
 {
-    _z0 = 0;
-    _z1 = 0;
-    _z2 = 0;
+    _f.z0 = 0;
+    _f.z1 = 0;
+    _f.z2 = 0;
     _dpk = 0;
+    _rms = 0;
+    _pk = 0;
     _cnt = 0;
+    _fill = 0;
 
     // Called by initialisation code.
     //
     // fsamp = sample frequency
-    // fsize = period size
+    // fsize = analysis hop size, independent of the host period size
     // hold  = peak hold time, seconds
     // fall  = peak fallback rate, dB/s
 
-    float t;
+    _fsamp = fsamp;
+    _holdtime = hold;
+    _fallrate = fall;
+    _f.wdcf = 5 * 6.28f / fsamp;               // dc filter coefficient
+    _f.wrms = 9.72f / fsamp;                   // ballistic filter coefficient
+    set_hop (fsize);
 
-    _wdcf = 5 * 6.28f / fsamp;                 // dc filter coefficient
-    _wrms = 9.72f / fsamp;                     // ballistic filter coefficient
-    t = (float) fsize / fsamp;                 // period time in seconds
-    _hold = (int)(hold / t + 0.5f);            // number of periods to hold peak
-    _fall = powf (10.0f, -0.05f * fall * t);   // per period fallback multiplier
+    // Coefficient powers for the block recursive filters.
+    for (int i = 0; i < 8; i++)
+    {
+        _f.pdcf [i] = (float) pow (1.0 - _f.wdcf, i + 1);
+        _f.prms [i] = (float) pow (1.0 - _f.wrms, i + 1);
+    }
 }
 
-float Kmeterdsp::process (const float *p, int n)
+void Kmeterdsp::set_hop (int fsize)
 {
-    // Called by JACK's process callback.
+    // Can be called from the plugin run() function.
     //
-    // p : pointer to sample buffer
-    // n : number of samples to process
+    // The samples already seen count for the next hop, which
+    // starts now.
 
-    float  s, t, z0, z1, z2;
+    float t;
 
-    // Get filter state.
-    z0 = _z0;
-    z1 = _z1;
-    z2 = _z2;
+    _fsize = fsize;
+    _fill = 0;
+    t = (float) fsize / _fsamp;                // hop time in seconds
+    _hold = (int)(_holdtime / t + 0.5f);       // number of hops to hold peak
+    _fall = powf (10.0f, -0.05f * _fallrate * t); // per hop fallback multiplier
+}
 
-    // Process n samples. Find digital peak value for this
-    // period and perform filtering on squared signal.
-    t = 0;
-    while (n--)
+bool Kmeterdsp::select_kernel (int kernel)
+{
+    // Called by initialisation code, not safe to use from process().
+
+    switch (kernel)
     {
-        s = *p++;
+    case KERNEL_AUTO:
+        return select_kernel (KERNEL_AVX2)
+            || select_kernel (KERNEL_NEON)
+            || select_kernel (KERNEL_SSE2)
+            || select_kernel (KERNEL_SCALAR);
 
-        if (s < -1.0f)
-            s = -1.0f;
-        else if (s > 1.0f)
-            s = 1.0f;
+    case KERNEL_SCALAR:
+        _kernels [DETECTOR_PEAK] = kernel_scalar<false>;
+        _kernels [DETECTOR_RMS] = kernel_scalar<true>;
+        return true;
 
-        z0 += _wdcf * (s - z0);      // DC filter
-        s -= z0;
-        s *= s;
-        if (t < s) t = s;            // Update digital peak.
-        z1 += _wrms * (s - z1);      // Update first filter.
-        z2 += _wrms * (z1 - z2);     // Update second filter.
+#ifdef KMETERDSP_X86
+    case KERNEL_SSE2:
+        __builtin_cpu_init ();
+        if (! __builtin_cpu_supports ("sse2")) return false;
+        _kernels [DETECTOR_PEAK] = kernel_sse2<false>;
+        _kernels [DETECTOR_RMS] = kernel_sse2<true>;
+        return true;
+
+    case KERNEL_AVX2:
+        __builtin_cpu_init ();
+        if (! __builtin_cpu_supports ("avx2") || ! __builtin_cpu_supports ("fma")) return false;
+        _kernels [DETECTOR_PEAK] = kernel_avx2<false>;
+        _kernels [DETECTOR_RMS] = kernel_avx2<true>;
+        return true;
+#endif
+
+#ifdef __ARM_NEON
+    case KERNEL_NEON:
+        _kernels [DETECTOR_PEAK] = kernel_neon<false>;
+        _kernels [DETECTOR_RMS] = kernel_neon<true>;
+        return true;
+#endif
     }
-    t = sqrtf (t);
 
-    // Save filter state.
-    _z0 = z0;
-    _z1 = z1;
-    _z2 = z2;
+    return false;
+}
+
+void Kmeterdsp::set_detector (int detector)
+{
+    // Can be called from the plugin run() function.
 
-    // Digital peak hold and fallback.
-    if (t > _dpk)
+    if (detector == _detector) return;
+
+    // The ballistic filters do not run for the peak detector,
+    // so they restart from silence.
+    if (detector == DETECTOR_RMS)
     {
-        // If higher than current value, update and set hold counter.
-        _dpk = t;
-        _cnt = _hold;
+        _f.z1 = 0;
+        _f.z2 = 0;
+        _rms = 0;
     }
-    else if (_cnt) _cnt--; // else decrement counter if not zero,
-    else
+
+    _detector = detector == DETECTOR_RMS ? DETECTOR_RMS : DETECTOR_PEAK;
+}
+
+const char *Kmeterdsp::kernel_name (int kernel)
+{
+    static const char *names [KERNEL_COUNT] = { "auto", "scalar", "sse2", "avx2", "neon" };
+
+    return (kernel >= 0 && kernel < KERNEL_COUNT) ? names [kernel] : "";
+}
+
+float Kmeterdsp::process (const float *p, int n)
+{
+    // Called by the plugin run() function.
+    //
+    // p : pointer to sample buffer
+    // n : number of samples to process, any amount
+    //
+    // The samples are split into hops of the size given to init(),
+    // a hop may span several calls. Peak hold and fallback are
+    // applied at the end of each hop, so the meter behaves the same
+    // whatever the host period size is.
+    //
+    // Returns the held digital peak, or the ballistic filter level
+    // for the RMS detector, as of the end of the last complete hop.
+
+    float  t;
+    int    k;
+
+    t = _pk;
+
+    while (n)
     {
-        _dpk *= _fall;     // else let the peak value fall back,
+        k = _fsize - _fill;
+        if (k > n) k = n;
+
+        // Find digital peak value for this hop and
+        // perform filtering on squared signal.
+        t = _kernels [_detector] (&_f, p, k, t);
+        p += k;
+        n -= k;
+        _fill += k;
+
+        if (_fill < _fsize) break;
+
+        _fill = 0;
+        t = sqrtf (t);
+
+        // Digital peak hold and fallback.
+        if (t > _dpk)
+        {
+            // If higher than current value, update and set hold counter.
+            _dpk = t;
+            _cnt = _hold;
+        }
+        else if (_cnt) _cnt--; // else decrement counter if not zero,
+        else
+        {
+            _dpk *= _fall;     // else let the peak value fall back,
+        }
+
+        // Level of the ballistic filter, scaled so that a sine wave
+        // reads its peak. The added constants avoid denormals.
+        if (_detector == DETECTOR_RMS)
+        {
+            _f.z1 += 1e-20f;
+            _f.z2 += 1e-20f;
+            _rms = sqrtf (2.0f * _f.z2);
+        }
+
+        t = 0;
     }
 
-    return _dpk;
+    _pk = t;
+
+    return _detector == DETECTOR_RMS ? _rms : _dpk;
 }
@@ -0,0 +1,6 @@
+/* Peak To CC, 2 channels. Sends the level of each of its 2 audio inputs as its own MIDI CC */
+
+#define PEAK_TO_CC_URI      "http://moddevices.com/plugins/mod-devel/PeakToCC_2C"
+#define PEAK_TO_CC_CHANNELS 2
+
+#include "../common/peaktocc.h"
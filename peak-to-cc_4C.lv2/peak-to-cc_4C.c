@@ -0,0 +1,6 @@
+/* Peak To CC, 4 channels. Sends the level of each of its 4 audio inputs as its own MIDI CC */
+
+#define PEAK_TO_CC_URI      "http://moddevices.com/plugins/mod-devel/PeakToCC_4C"
+#define PEAK_TO_CC_CHANNELS 4
+
+#include "../common/peaktocc.h"
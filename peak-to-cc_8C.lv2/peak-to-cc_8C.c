@@ -0,0 +1,6 @@
+/* Peak To CC, 8 channels. Sends the level of each of its 8 audio inputs as its own MIDI CC */
+
+#define PEAK_TO_CC_URI      "http://moddevices.com/plugins/mod-devel/PeakToCC_8C"
+#define PEAK_TO_CC_CHANNELS 8
+
+#include "../common/peaktocc.h"